@@ -1,7 +1,7 @@
 #pragma once
 #include <vector>
 
-#include "../interrupt/vector.hpp"
+#include "../interrupt/irq.hpp"
 #include "../log.hpp"
 #include "../mutex.hpp"
 #include "../pci.hpp"
@@ -42,7 +42,7 @@ struct IdentifySync {
 
 class SATADevice {
   private:
-    friend auto initialize(const pci::Device& dev) -> std::unique_ptr<Controller>;
+    friend auto initialize(const pci::Device& dev, interrupt::IRQ& irq) -> std::unique_ptr<Controller>;
 
     static constexpr auto bytes_per_sector = size_t(512);
 
@@ -284,12 +284,10 @@ class Controller {
         for(auto& d : this->ports) {
             d.identify(identify_sync);
         }
-
-        process::manager->post_kernel_message_with_cli(MessageType::AHCIInterrupt);
     }
 };
 
-inline auto initialize(const pci::Device& dev) -> std::unique_ptr<Controller> {
+inline auto initialize(const pci::Device& dev, interrupt::IRQ& irq) -> std::unique_ptr<Controller> {
     using namespace internal;
 
     logger(LogLevel::Debug, "ahci: controller found at %d.%d.%d\n", dev.bus, dev.device, dev.function);
@@ -382,8 +380,8 @@ inline auto initialize(const pci::Device& dev) -> std::unique_ptr<Controller> {
         port.start();
     }
 
-    const auto bsp_local_apic_id = *reinterpret_cast<const uint32_t*>(0xFEE00020) >> 24;
-    if(const auto error = dev.configure_msi_fixed_destination(bsp_local_apic_id, ::pci::MSITriggerMode::Level, ::pci::MSIDeliveryMode::Fixed, ::interrupt::Vector::AHCI, 0)) {
+    irq = interrupt::IRQ{.device = &dev, .type = interrupt::MSIType::MSI};
+    if(const auto error = interrupt::irq_manager->add(irq)) {
         logger(LogLevel::Error, "ahci: failed to setup msi: %d\n", error.as_int());
         return nullptr;
     }
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+
+namespace amd64 {
+constexpr auto rflags_interrupt_flag = uint64_t(1) << 9;
+
+inline auto read_rflags() -> uint64_t {
+    auto rflags = uint64_t();
+    __asm__ volatile(
+        "pushfq;"
+        "pop %0;"
+        : "=r"(rflags));
+    return rflags;
+}
+
+// disables interrupts of this processor while alive
+class InterruptGuard {
+  private:
+    bool enabled;
+
+  public:
+    InterruptGuard() : enabled((read_rflags() & rflags_interrupt_flag) != 0) {
+        __asm__ volatile("cli" ::: "memory");
+    }
+
+    ~InterruptGuard() {
+        if(enabled) {
+            __asm__ volatile("sti" ::: "memory");
+        }
+    }
+};
+} // namespace amd64
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+
+namespace amd64 {
+inline auto read_tsc() -> uint64_t {
+    auto low  = uint32_t();
+    auto high = uint32_t();
+    __asm__ volatile(
+        "rdtsc;"
+        : "=a"(low), "=d"(high));
+    return uint64_t(high) << 32 | low;
+}
+} // namespace amd64
@@ -77,19 +77,26 @@ write_msr:
 
 global jump_to_app
 jump_to_app:  ; void jump_to_app(uint64_t id, int64_t data, uint16_t ss(rdx), uint64_t rip(rcx), uint64_t rsp(r8), uint64_t* system_stack_ptr(r9));
-    mov [r9], rsp ; save system stack pointer
+    mov [r9], rsp     ; save system stack pointer
+    mov [gs:8], rsp   ; and publish it to PerCPU::system_stack for syscall_entry
+
+    pushfq
+    pop rax   ; RFLAGS of the app
+    cli       ; no interrupt may enter ring 0 with the user gs base
 
     push rdx  ; SS
     push r8   ; RSP
+    push rax  ; RFLAGS
     add rdx, 8
     push rdx  ; CS
     push rcx  ; RIP
-    retfq
+    swapgs    ; user gs base, the per-cpu base goes to KernelGSBase
+    iretq
 
 extern syscall_table
-extern get_stack_ptr
 global syscall_entry
 syscall_entry:
+    swapgs    ; per-cpu base, interrupts are masked by FMASK until the system stack is set
     push rbp
     push rcx  ; original RIP
     push r11  ; original RFLAGS
@@ -101,7 +108,7 @@ syscall_entry:
     and rsp, 0xFFFFFFFFFFFFFFF0
     push rax            ; save rax
     push rdx            ; save rdx
-    call get_stack_ptr  ; rax = system_stack_address
+    mov rax, [gs:8]     ; rax = PerCPU::system_stack
     mov rdx, [rsp + 0]  ; restore saved rdx to rdx
     mov [rax - 16], rdx ; send rdx value to system stack
     mov rdx, [rsp + 8]  ; restore saved rax to rdx
@@ -112,7 +119,9 @@ syscall_entry:
     pop rax             ; receive copied rax
 
     and rsp, 0xFFFFFFFFFFFFFFF0
+    sti
     call [syscall_table + 8 * eax]
+    cli       ; sysret restores RFLAGS from r11
 
     mov rsp, rbp 
 
@@ -120,6 +129,7 @@ syscall_entry:
     pop rcx
     pop rbp
 
+    swapgs
     o64 sysret
 
 global load_tr
@@ -127,15 +137,27 @@ load_tr:
     ltr di
     ret
 
-extern int_handler_lapic_timer
-global int_handler_lapic_timer_entry
-int_handler_lapic_timer_entry:
+; swaps to the per-cpu gs base if the interrupt came from ring 3
+; the stack must point to the RIP of the interrupt frame
+%macro swapgs_if_user 0
+    test qword [rsp + 8], 3  ; CS
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
+
+; interrupt entry which passes the ThreadContext of the interrupted thread to %1,
+; so that the handler can switch threads by modifying it
+%macro context_switching_entry 1
+extern %1
+global %{1}_entry
+%{1}_entry:
+    swapgs_if_user
     push rbp
     mov rbp, rsp
 
     ; construct TaskContext on the stack
     sub rsp, 512
-    fxsave [rsp]
     push r15
     push r14
     push r13
@@ -153,6 +175,18 @@ int_handler_lapic_timer_entry:
     push rbx
     push rax
 
+    ; save fpu state only if the thread has used it(CR0.TS is clear)
+    xor edx, edx
+    mov rax, cr0
+    test rax, 0x08
+    jnz %%fpu_unused
+    fxsave [rbp - 512]
+    mov edx, 1
+    jmp %%fpu_saved
+%%fpu_unused:
+    clts                     ; the handler may use sse
+%%fpu_saved:
+
     mov ax, fs
     mov bx, gs
     mov rcx, cr3
@@ -161,13 +195,23 @@ int_handler_lapic_timer_entry:
     push rax                 ; FS
     push qword [rbp + 0x28]  ; SS
     push qword [rbp + 0x10]  ; CS
-    push rbp                 ; reserved1
+    push rdx                 ; FPU_USED
     push qword [rbp + 0x18]  ; RFLAGS
     push qword [rbp + 0x08]  ; RIP
     push rcx                 ; CR3
 
     mov rdi, rsp
-    call int_handler_lapic_timer
+    call %1
+
+    cmp qword [rsp + 0x18], 0
+    je %%fpu_lazy
+    fxrstor [rbp - 512]
+    jmp %%fpu_restored
+%%fpu_lazy:
+    mov rax, cr0
+    or rax, 0x08
+    mov cr0, rax
+%%fpu_restored:
 
     add rsp, 8*8  ; ignore CR3 to GS
     pop rax
@@ -185,10 +229,50 @@ int_handler_lapic_timer_entry:
     pop r13
     pop r14
     pop r15
-    fxrstor [rsp]
 
     mov rsp, rbp
     pop rbp
+    swapgs_if_user
+    iretq
+%endmacro
+
+context_switching_entry int_handler_lapic_timer
+context_switching_entry int_handler_reschedule
+
+; first fpu use of a thread after CR0.TS was set by restore_context
+extern int_handler_device_not_available
+global int_handler_device_not_available_entry
+int_handler_device_not_available_entry:
+    swapgs_if_user
+    push rbp
+    mov rbp, rsp
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+
+    clts
+    and rsp, 0xFFFFFFFFFFFFFFF0
+    call int_handler_device_not_available ; rax = context of this thread
+    fxrstor [rax + 0xc0]
+
+    lea rsp, [rbp - 8*9]
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+    pop rbp
+    swapgs_if_user
     iretq
 
 extern kernel_main_stack
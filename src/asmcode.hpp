@@ -14,4 +14,6 @@ auto jump_to_app(uint64_t id, int64_t data, uint16_t ss, uint64_t rip, uint64_t
 auto syscall_entry() -> void;
 auto load_tr(uint16_t sel) -> void;
 auto int_handler_lapic_timer_entry() -> void;
+auto int_handler_reschedule_entry() -> void;
+auto int_handler_device_not_available_entry() -> void;
 }
@@ -3,4 +3,11 @@
 namespace constants {
 constexpr auto supported_memory_limit = 64; // GiB
 constexpr auto context_switch_frequency = 100; // Hz
+constexpr auto kernel_stack_size = 16 * 1024; // bytes
+constexpr auto enable_lockstat = false; // lock contention statistics, see "lockstat" shell command
+constexpr auto system_workqueue_workers = 4; // per processor
+constexpr auto memory_low_watermark = 2; // percent of usable frames, reclaim starts below this
+constexpr auto memory_high_watermark = 4; // percent of usable frames, reclaim stops above this
+constexpr auto writeback_expire = 3000; // ms, dirty files older than this are written back
+constexpr auto writeback_dirty_ratio = 10; // percent of usable frames, writeback starts at once above this
 }
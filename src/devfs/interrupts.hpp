@@ -0,0 +1,121 @@
+#pragma once
+#include "../fs/drivers/dev/base.hpp"
+#include "../interrupt/irq.hpp"
+#include "../interrupt/stats.hpp"
+
+namespace devfs {
+// text table of interrupt counts and handler cycles per processor and vector
+// the table is taken when a handle is opened, so reads through one handle are consistent
+class InterruptStats : public fs::dev::Device {
+  private:
+    // devfs captures the file size at lookup, so the size is a fixed upper bound and reads stop at the end of the table
+    static constexpr auto max_table_size = size_t(64 * 1024);
+
+    static auto get_vector_name(const size_t vector, const smp::ProcessorNumber processor, const std::vector<interrupt::IRQ>& irqs) -> std::array<char, 24> {
+        static constexpr auto exception_names = std::array{
+            "divide error",
+            "debug",
+            "nmi",
+            "breakpoint",
+            "overflow",
+            "bound range exceeded",
+            "invalid opcode",
+            "device not available",
+            "double fault",
+            "coprocessor segment",
+            "invalid tss",
+            "segment not present",
+            "stack fault",
+            "general protection",
+            "page fault",
+            "reserved",
+            "fpu floating point",
+            "alignment check",
+            "machine check",
+            "simd floating point",
+            "virtualization",
+            "control protection",
+        };
+
+        auto buf = std::array<char, 24>();
+        if(vector < exception_names.size()) {
+            snprintf(buf.data(), buf.size(), "%s", exception_names[vector]);
+        } else if(vector == interrupt::Vector::LAPICTimer) {
+            snprintf(buf.data(), buf.size(), "lapic timer");
+        } else if(vector == interrupt::Vector::Reschedule) {
+            snprintf(buf.data(), buf.size(), "reschedule");
+        } else {
+            snprintf(buf.data(), buf.size(), "unknown");
+            for(const auto& irq : irqs) {
+                if(irq.processor == processor && size_t(irq.vector) == vector) {
+                    snprintf(buf.data(), buf.size(), "pci %02x:%02x.%x", irq.device->bus, irq.device->device, irq.device->function);
+                    break;
+                }
+            }
+        }
+        return buf;
+    }
+
+    static auto build_table() -> std::string {
+        const auto irqs  = interrupt::irq_manager->get_irqs();
+        auto       table = std::string("CPU VECTOR NAME                            COUNT           CYCLES    AVERAGE\n");
+        auto       line  = std::array<char, 128>();
+        for(auto processor = size_t(0); processor < process::manager->get_processor_count(); processor += 1) {
+            for(auto vector = size_t(0); vector < interrupt::stats[processor].size(); vector += 1) {
+                const auto& stat   = interrupt::stats[processor][vector];
+                const auto  count  = stat.count.load(std::memory_order_relaxed);
+                const auto  cycles = stat.cycles.load(std::memory_order_relaxed);
+                if(count == 0) {
+                    continue;
+                }
+                const auto name = get_vector_name(vector, processor, irqs);
+                const auto len  = snprintf(line.data(), line.size(), "%3lu   0x%02lx %-23s %12lu %16lu %10lu\n", processor, vector, name.data(), count, cycles, cycles / count);
+                if(table.size() + len > max_table_size) {
+                    return table;
+                }
+                table.append(line.data(), len);
+            }
+        }
+        return table;
+    }
+
+  public:
+    auto read(uint64_t& handle_data, const size_t block, const size_t count, void* const buffer) -> Result<size_t> override {
+        const auto& table = *std::bit_cast<std::string*>(handle_data);
+        if(block >= table.size()) {
+            return 0;
+        }
+        const auto len = std::min(count, table.size() - block);
+        memcpy(buffer, table.data() + block, len);
+        return len;
+    }
+
+    auto create_handle_data() -> Result<uint64_t> override {
+        return std::bit_cast<uint64_t>(new std::string(build_table()));
+    }
+
+    auto destroy_handle_data(uint64_t& handle_data) -> Error override {
+        delete std::bit_cast<std::string*>(handle_data);
+        handle_data = 0;
+        return Success();
+    }
+
+    auto get_filesize() const -> size_t override {
+        return max_table_size;
+    }
+
+    auto get_device_type() const -> fs::DeviceType override {
+        return fs::DeviceType::None;
+    }
+
+    auto get_attributes() const -> fs::Attributes override {
+        return fs::Attributes{
+            .read_level  = fs::OpenLevel::Multi,
+            .write_level = fs::OpenLevel::Block,
+            .exclusive   = false,
+            .volume_root = false,
+            .cache       = false,
+        };
+    }
+};
+} // namespace devfs
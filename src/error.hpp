@@ -38,6 +38,8 @@ class [[nodiscard]] Error {
         DeadThread,
         NoSuchProcess,
         NoSuchThread,
+        InvalidAffinity,
+        TooManyEvents,
         // filesystem
         IOError,
         InvalidData,
@@ -0,0 +1,82 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "../mutex.hpp"
+
+namespace fs {
+class FileOperator;
+
+// resolved path components, keyed by (parent, name)
+// parents and children are stored followed through mountpoints,
+// an entry pins nothing by itself, so whoever erases a child from the tree invalidates its entry first
+class DentryCache {
+  private:
+    struct KeyView {
+        const FileOperator* parent;
+        std::string_view    name;
+    };
+
+    struct Key {
+        const FileOperator* parent;
+        std::string         name;
+
+        operator KeyView() const {
+            return KeyView{parent, name};
+        }
+    };
+
+    struct KeyCompare {
+        using is_transparent = void;
+
+        auto operator()(const KeyView a, const KeyView b) const -> bool {
+            return a.parent == b.parent && a.name == b.name;
+        }
+    };
+
+    struct KeyHash {
+        using is_transparent = void;
+
+        auto operator()(const KeyView key) const -> size_t {
+            return std::hash<std::string_view>()(key.name) ^ (std::bit_cast<uintptr_t>(key.parent) * 0x9E3779B97F4A7C15);
+        }
+    };
+
+  public:
+    using Map = std::unordered_map<Key, FileOperator*, KeyHash, KeyCompare>;
+
+  private:
+    SharedCritical<Map> critical_map;
+
+  public:
+    // children found through the map stay alive while the lock is held
+    auto read_access() const -> std::pair<mutex_like::AutoSharedMutex<SharedMutex>, const Map&> {
+        return critical_map.read_access();
+    }
+
+    static auto find(const Map& map, const FileOperator* const parent, const std::string_view name) -> FileOperator* {
+        const auto p = map.find(KeyView{parent, name});
+        return p != map.end() ? p->second : nullptr;
+    }
+
+    auto insert(const FileOperator* const parent, const std::string_view name, FileOperator* const child) -> void {
+        auto [lock, map] = critical_map.write_access();
+        map.insert_or_assign(Key{parent, std::string(name)}, child);
+    }
+
+    auto invalidate(const FileOperator* const parent, const std::string_view name) -> void {
+        auto [lock, map] = critical_map.write_access();
+        if(const auto p = map.find(KeyView{parent, name}); p != map.end()) {
+            map.erase(p);
+        }
+    }
+
+    auto clear() -> void {
+        auto [lock, map] = critical_map.write_access();
+        map.clear();
+    }
+};
+
+inline auto dentry_cache = (DentryCache*)(nullptr);
+} // namespace fs
@@ -27,8 +27,13 @@ struct FileAbstractWithDriverData {
     uint64_t     driver_data;
 };
 
+class Writeback;
+
 class Driver {
   public:
+    // set by Manager, writes dirty caches of this driver's files back
+    Writeback* writeback = nullptr;
+
     // read "count" block(=2^FileAbstract::blocksize_exp) from device to "buffer"
     // move internal cursor on success
     // returns number of read blocks or error
@@ -52,6 +57,11 @@ class Driver {
         return DeviceType::None;
     }
 
+    // whether write() stores cached pages, only such drivers get a Writeback
+    virtual auto can_write_back() -> bool {
+        return false;
+    }
+
     virtual auto create_device(uint64_t fop_data, uint64_t& handle_data, std::string_view name, uintptr_t device_impl) -> Result<FileAbstractWithDriverData> {
         return Error::Code::NotImplemented;
     }
@@ -1,4 +1,5 @@
 #pragma once
+#include "../../../rcu.hpp"
 #include "../../../util/string-map.hpp"
 #include "block.hpp"
 #include "fb.hpp"
@@ -9,7 +10,14 @@ class Driver : public fs::Driver {
   private:
     FileAbstractWithDriverData root;
 
-    StringMap<std::unique_ptr<Device>> devices;
+    // devices are owned by their creators
+    using Devices = StringMap<Device*>;
+
+    rcu::Protected<Devices> devices;
+
+    static auto build_abstract(const std::string& name, Device& device) -> FileAbstractWithDriverData {
+        return FileAbstractWithDriverData{{name, device.get_filesize(), FileType::Device, device.get_blocksize_exp(), device.get_attributes()}, std::bit_cast<uint64_t>(&device)};
+    }
 
   public:
     auto read(const uint64_t fop_data, uint64_t& handle_data, const size_t block, const size_t count, void* const buffer) -> Result<size_t> override {
@@ -30,15 +38,19 @@ class Driver : public fs::Driver {
         return device.write(handle_data, block, count, buffer);
     }
 
+    auto can_write_back() -> bool override {
+        return true;
+    }
+
     auto find(const uint64_t fop_data, uint64_t& handle_data, const std::string_view name) -> Result<FileAbstractWithDriverData> override {
         if(fop_data != 0) {
             return Error::Code::NotDirectory;
         }
 
+        const auto  guard   = rcu::ReadGuard();
+        const auto& devices = this->devices.read(guard);
         if(const auto p = devices.find(name); p != devices.end()) {
-            auto& name   = p->first;
-            auto& device = *p->second;
-            return FileAbstractWithDriverData{{name, device.get_filesize(), FileType::Device, device.get_blocksize_exp(), device.get_attributes()}, std::bit_cast<uint64_t>(&device)};
+            return build_abstract(p->first, *p->second);
         } else {
             return Error::Code::NoSuchFile;
         }
@@ -53,14 +65,14 @@ class Driver : public fs::Driver {
             return Error::Code::NotDirectory;
         }
 
+        const auto  guard   = rcu::ReadGuard();
+        const auto& devices = this->devices.read(guard);
         if(index >= devices.size()) {
             return Error::Code::EndOfFile;
         }
 
-        const auto p      = std::next(devices.begin(), index);
-        auto&      name   = p->first;
-        auto&      device = *p->second;
-        return FileAbstractWithDriverData{{name, device.get_filesize(), FileType::Device, device.get_blocksize_exp(), device.get_attributes()}, std::bit_cast<uint64_t>(&device)};
+        const auto p = std::next(devices.begin(), index);
+        return build_abstract(p->first, *p->second);
     }
 
     auto remove(const uint64_t fop_data, uint64_t& handle_data, const std::string_view name) -> Error override {
@@ -68,12 +80,14 @@ class Driver : public fs::Driver {
             return Error::Code::NotDirectory;
         }
 
-        if(const auto p = devices.find(name); p != devices.end()) {
-            devices.erase(p);
-            return Success();
-        } else {
-            return Error::Code::NoSuchFile;
-        }
+        return devices.update([name](Devices& devices) -> Error {
+            if(const auto p = devices.find(name); p != devices.end()) {
+                devices.erase(p);
+                return Success();
+            } else {
+                return Error::Code::NoSuchFile;
+            }
+        });
     }
 
     auto get_device_type(const uint64_t fop_data) -> DeviceType override {
@@ -86,13 +100,14 @@ class Driver : public fs::Driver {
             return Error::Code::NotDirectory;
         }
 
-        if(devices.find(name) != devices.end()) {
-            return Error::Code::FileExists;
-        }
+        return devices.update([name, device_impl](Devices& devices) -> Result<FileAbstractWithDriverData> {
+            if(devices.find(name) != devices.end()) {
+                return Error::Code::FileExists;
+            }
 
-        const auto device = std::bit_cast<Device*>(device_impl);
-        const auto p      = devices.emplace(name, device).first;
-        return FileAbstractWithDriverData{{p->first, device->get_filesize(), FileType::Device, device->get_blocksize_exp(), device->get_attributes()}, std::bit_cast<uint64_t>(&device)};
+            const auto p = devices.emplace(name, std::bit_cast<Device*>(device_impl)).first;
+            return build_abstract(p->first, *p->second);
+        });
     }
 
     auto control_device(const uint64_t fop_data, uint64_t& handle_data, const DeviceOperation op, void* const arg) -> Error override {
@@ -147,7 +162,7 @@ class Driver : public fs::Driver {
     }
 
     auto create_handle_data(const uint64_t fop_data) -> Result<uint64_t> override {
-        if(fop_data != 0) {
+        if(fop_data == 0) {
             return 0;
         }
 
@@ -156,7 +171,7 @@ class Driver : public fs::Driver {
     }
 
     auto destroy_handle_data(const uint64_t fop_data, uint64_t& handle_data) -> Error override {
-        if(fop_data != 0) {
+        if(fop_data == 0) {
             return Success();
         }
 
@@ -332,7 +332,7 @@ class Driver : public fs::Driver {
         for(auto i = uint32_t(0);; i += 1) {
             const auto dinfo_r = readdir(data, handle, i);
             if(!dinfo_r) {
-                return dinfo_r.as_error();
+                return dinfo_r.as_error() == Error::Code::EndOfFile ? Error::Code::NoSuchFile : dinfo_r.as_error();
             }
             const auto& dinfo = dinfo_r.as_value();
 
@@ -1,6 +1,7 @@
 #pragma once
 #include <array>
 #include <cstdint>
+#include <set>
 #include <string>
 #include <string_view>
 #include <unordered_map>
@@ -8,9 +9,12 @@
 #include "../error.hpp"
 #include "../log.hpp"
 #include "../memory/allocator.hpp"
+#include "../memory/shrinker.hpp"
 #include "../mutex.hpp"
 #include "../process/manager.hpp"
+#include "../util/lru.hpp"
 #include "../util/string-map.hpp"
+#include "dentry.hpp"
 #include "driver.hpp"
 #include "file-abstract.hpp"
 #include "pagecache.hpp"
@@ -25,6 +29,31 @@ class FileOperator;
 
 auto follow_mountpoints(FileOperator* fop) -> FileOperator*;
 
+// file operators no handle refers to, coldest first
+// they stay in the tree with their page caches until memory runs short
+class FopLRU : public memory::Shrinker {
+  private:
+    spinlock::SpinLock    mutex;
+    LRUList<FileOperator> list;
+
+  public:
+    // taken by whoever erases file operators from the tree, before any lock of children
+    Mutex tree_mutex;
+
+    // call with the counts of fop locked, when its last handle is closed
+    auto release(FileOperator& fop, bool cold) -> void;
+
+    // call with the counts of fop locked, when it is opened again, or before erasing it
+    auto erase(FileOperator& fop) -> void;
+
+    // erases unused descendants of dir, call with tree_mutex and the children of dir locked
+    auto evict_children(FileOperator& dir, StringMap<FileOperator>& children) -> void;
+
+    auto shrink(size_t frames) -> size_t override;
+};
+
+inline auto fop_lru = (FopLRU*)(nullptr);
+
 class FileOperator {
   private:
     Driver* const driver;
@@ -33,6 +62,14 @@ class FileOperator {
     std::shared_ptr<CacheProvider> cache_provider;
     // Critical<std::vector<CachePage>> critical_cache;
 
+    // pages written through this fop, guarded by the lock of cache_provider
+    std::set<size_t> dirty_pages;
+    Error            writeback_error;          // first failure since the last sync
+    std::atomic_bool writeback_queued = false; // Writeback refers to this fop
+
+    // longest run of pages written at once
+    static constexpr auto max_writeback_pages = size_t(32);
+
     static constexpr auto ceil(const std::integral auto a, const std::integral auto b) -> auto{
         return (a + b - 1) / b;
     }
@@ -82,12 +119,18 @@ class FileOperator {
 
                     cache.page  = std::move(page);
                     cache.state = CachePage::State::Clean;
+                    // the cache is the only copy of keep_on_close files
+                    if(!attributes.keep_on_close) {
+                        page_lru->add(cache);
+                    }
                 } break;
                 case CachePage::State::Dirty:
                     // debug::println("      dirty");
+                    cache.referenced.store(true, std::memory_order_relaxed);
                     break;
                 case CachePage::State::Clean:
                     // debug::println("      clean");
+                    cache.referenced.store(true, std::memory_order_relaxed);
                     break;
                 }
             }
@@ -181,9 +224,98 @@ class FileOperator {
         }
 
         // debug::println("  done ", copyable);
+        if(write && !attributes.keep_on_close) {
+            mark_dirty(cache_begin, cache_end);
+        }
         return copyable;
     }
 
+    // call with cache_provider locked, defined in writeback.hpp
+    auto mark_dirty(size_t begin, size_t end) -> void;
+
+    // writes count pages from first in one driver write, call with cache_provider locked
+    auto write_pages(uint64_t& handle_driver_data, const size_t first, const size_t count) -> Error {
+        const auto blocksize       = size_t(1) << blocksize_exp;
+        const auto blocks_per_page = paging::bytes_per_page >> blocksize_exp;
+        const auto filesize_blocks = ceil(filesize, blocksize);
+        const auto block_begin     = first * blocks_per_page;
+        if(block_begin >= filesize_blocks) {
+            return Success();
+        }
+        const auto blocks = std::min(count * blocks_per_page, filesize_blocks - block_begin);
+
+        if(count == 1) {
+            const auto r = driver->write(driver_data, handle_driver_data, block_begin, blocks, cache_provider->at(first).get_frame());
+            return r ? Success() : r.as_error();
+        }
+
+        // the pages are scattered in memory, so a run is gathered into a contiguous buffer
+        auto buffer_r = memory::allocate(count);
+        if(!buffer_r) {
+            for(auto i = size_t(0); i < count; i += 1) {
+                if(const auto e = write_pages(handle_driver_data, first + i, 1)) {
+                    return e;
+                }
+            }
+            return Success();
+        }
+        auto&      buffer = buffer_r.as_value();
+        const auto frames = static_cast<std::byte*>(buffer->get_frame());
+        for(auto i = size_t(0); i < count; i += 1) {
+            memcpy(frames + i * paging::bytes_per_page, cache_provider->at(first + i).get_frame(), paging::bytes_per_page);
+        }
+        const auto r = driver->write(driver_data, handle_driver_data, block_begin, blocks, frames);
+        return r ? Success() : r.as_error();
+    }
+
+    // names the driver reported missing
+    // generation is bumped whenever a name may appear, so a lookup racing with create does not record a stale miss
+    struct Negatives {
+        StringSet names;
+        uint64_t  generation = 0;
+    };
+
+    // bounds memory spent on probes for random names
+    static constexpr auto max_negatives = size_t(64);
+
+    SharedCritical<Negatives> critical_negatives;
+
+    auto driver_find(PerHandle& per_handle, const std::string_view name) -> Result<FileAbstractWithDriverData> {
+        auto generation = uint64_t();
+        {
+            auto [lock, negatives] = critical_negatives.read_access();
+            if(negatives.names.contains(name)) {
+                return Error::Code::NoSuchFile;
+            }
+            generation = negatives.generation;
+        }
+
+        auto result = driver->find(driver_data, per_handle.driver_data, name);
+        if(!result && result.as_error() == Error::Code::NoSuchFile) {
+            add_negative(name, generation);
+        }
+        return result;
+    }
+
+    auto add_negative(const std::string_view name, const uint64_t generation) -> void {
+        auto [lock, negatives] = critical_negatives.write_access();
+        if(negatives.generation != generation) {
+            return;
+        }
+        if(negatives.names.size() >= max_negatives) {
+            negatives.names.clear();
+        }
+        negatives.names.emplace(name);
+    }
+
+    auto remove_negative(const std::string_view name) -> void {
+        auto [lock, negatives] = critical_negatives.write_access();
+        negatives.generation += 1;
+        if(const auto p = negatives.names.find(name); p != negatives.names.end()) {
+            negatives.names.erase(p);
+        }
+    }
+
     auto extract_abstract(Result<FileAbstractWithDriverData> abstract) -> Result<FileAbstract> {
         if(!abstract) {
             return abstract.as_error();
@@ -207,8 +339,10 @@ class FileOperator {
     const BlockSizeExp blocksize_exp;
     const Attributes   attributes;
 
-    Critical<Count>    critical_counts;
-    Critical<Children> critical_children;
+    LRUEntry<FileOperator> lru_entry; // guarded by FopLRU
+
+    SharedCritical<Count>    critical_counts;
+    SharedCritical<Children> critical_children;
 
     auto read(PerHandle& per_handle, const size_t offset, const size_t size, void* const buffer) -> Result<size_t> {
         return copy(per_handle, offset, size, buffer, false);
@@ -244,16 +378,18 @@ class FileOperator {
     */
 
     auto find(PerHandle& per_handle, const std::string_view name) -> Result<FileAbstract> {
-        auto [lock, children] = critical_children.access();
+        auto [lock, children] = critical_children.read_access();
         if(const auto p = children.find(std::string(name)); p != children.end()) {
             return p->second.build_abstract();
         }
 
-        return extract_abstract(driver->find(driver_data, per_handle.driver_data, name));
+        return extract_abstract(driver_find(per_handle, name));
     }
 
     auto create(PerHandle& per_handle, const std::string_view name, const FileType type) -> Result<FileAbstract> {
-        return extract_abstract(driver->create(driver_data, per_handle.driver_data, name, type));
+        auto result = driver->create(driver_data, per_handle.driver_data, name, type);
+        remove_negative(name);
+        return extract_abstract(std::move(result));
     }
 
     auto readdir(PerHandle& per_handle, const size_t index) -> Result<FileAbstract> {
@@ -261,20 +397,37 @@ class FileOperator {
     }
 
     auto remove(PerHandle& per_handle, const std::string_view name) -> Error {
-        auto [lock, children] = critical_children.access();
-        if(const auto p = children.find(name); p == children.end()) {
-            return driver->remove(driver_data, per_handle.driver_data, name);
-        } else {
-            auto& child = p->second;
-            if(child.is_busy()) {
-                return Error::Code::FileOpened;
-            }
-            if(const auto e = driver->remove(driver_data, per_handle.driver_data, name)) {
-                return e;
-            } else {
-                children.erase(p);
-                return Success();
+        while(true) {
+            {
+                const auto tree_lock  = SmartMutex(fop_lru->tree_mutex);
+                auto [lock, children] = critical_children.write_access();
+                const auto p          = children.find(name);
+                if(p == children.end()) {
+                    return driver->remove(driver_data, per_handle.driver_data, name);
+                }
+
+                // a lookup holding the cache lock may be about to open the child
+                dentry_cache->invalidate(this, name);
+                auto& child = p->second;
+                {
+                    auto [child_lock, grandchildren] = child.critical_children.write_access();
+                    fop_lru->evict_children(child, grandchildren);
+                }
+                if(child.is_used()) {
+                    return Error::Code::FileOpened;
+                }
+                // nobody can open it again, so what failed to be written is of no use
+                if(child.detach_writeback(true)) {
+                    if(const auto e = driver->remove(driver_data, per_handle.driver_data, name)) {
+                        return e;
+                    }
+                    fop_lru->erase(child);
+                    children.erase(p);
+                    return Success();
+                }
             }
+            // a writeback pass is writing the child and needs the tree mutex to finish
+            wait_writeback();
         }
     }
 
@@ -287,7 +440,9 @@ class FileOperator {
     }
 
     auto create_device(PerHandle& per_handle, const std::string_view name, const uintptr_t device_impl) -> Result<FileAbstract> {
-        return extract_abstract(driver->create_device(driver_data, per_handle.driver_data, name, device_impl));
+        auto result = driver->create_device(driver_data, per_handle.driver_data, name, device_impl);
+        remove_negative(name);
+        return extract_abstract(std::move(result));
     }
 
     auto control_device(PerHandle& per_handle, const DeviceOperation op, void* const arg) -> Error {
@@ -319,40 +474,57 @@ class FileOperator {
         return FileAbstract{name, filesize, type, blocksize_exp, attributes};
     }
 
-    auto prepare_fop(Children& children, PerHandle& per_handle, const std::string_view name, std::optional<FileOperator>& storage) -> Result<FileOperator*> {
+    // the lock of children only guards the map, so a shared lock is enough to get a mutable child
+    auto find_child(const Children& children, const std::string_view name) -> FileOperator* {
         if(const auto p = children.find(std::string(name)); p != children.end()) {
-            return follow_mountpoints(&p->second);
+            return follow_mountpoints(const_cast<FileOperator*>(&p->second));
         }
+        return nullptr;
+    }
 
-        const auto find_r = driver->find(driver_data, per_handle.driver_data, name);
+    // does not touch children, so the caller can do this without locking
+    auto load_child(PerHandle& per_handle, const std::string_view name) -> Result<FileOperator> {
+        const auto find_r = driver_find(per_handle, name);
         if(!find_r) {
             return find_r.as_error();
         }
-        const auto& find = find_r.as_value();
-
-        return &storage.emplace(FileOperator(*driver, find));
+        return FileOperator(*driver, find_r.as_value());
     }
 
-    auto append_child(FileOperator&& child) -> FileOperator* {
-        auto [lock, children] = critical_children.access();
+    auto append_child(Children& children, FileOperator&& child) -> FileOperator* {
+        child.parent = this;
         return &children.emplace(child.name, std::move(child)).first->second;
     }
 
     // used by Controller
     auto is_busy() -> bool {
+        return writeback_queued.load() || has_dirty_pages() || is_used();
+    }
+
+    // pages only in the cache, which on drivers without a Writeback nothing writes back
+    auto has_dirty_pages() -> bool {
+        if(!cache_provider) {
+            return false;
+        }
+        auto lock = cache_provider->lock();
+        return !dirty_pages.empty();
+    }
+
+    // opened, mounted on, or with children
+    auto is_used() -> bool {
         if(mount != nullptr) {
             return true;
         }
 
         {
-            auto [lock, counts] = critical_counts.access();
+            auto [lock, counts] = critical_counts.read_access();
             if(counts.read_count != 0 || counts.write_count != 0) {
                 return true;
             }
         }
 
         {
-            auto [lock, children] = critical_children.access();
+            auto [lock, children] = critical_children.read_access();
             if(!children.empty()) {
                 return true;
             }
@@ -361,10 +533,110 @@ class FileOperator {
         return false;
     }
 
+    // writes dirty pages back in ascending order, adjacent pages go in one driver write
+    // pages which failed stay dirty for the next pass, the error is kept for sync()
+    auto flush() -> Error {
+        if(!attributes.cache) {
+            return Success();
+        }
+        {
+            auto lock = cache_provider->lock();
+            if(dirty_pages.empty()) {
+                return Success();
+            }
+        }
+
+        auto handle_data_r = driver->create_handle_data(driver_data);
+        if(!handle_data_r) {
+            return handle_data_r.as_error();
+        }
+        auto& handle_data = handle_data_r.as_value();
+
+        auto result = Error();
+        {
+            auto lock = cache_provider->lock();
+            // pages before next were written or failed in this pass
+            auto next = size_t(0);
+            while(true) {
+                const auto p = dirty_pages.lower_bound(next);
+                if(p == dirty_pages.end()) {
+                    break;
+                }
+                const auto first = *p;
+                auto       count = size_t(0);
+                while(count < max_writeback_pages && dirty_pages.contains(first + count) && cache_provider->at(first + count).state == CachePage::State::Dirty) {
+                    count += 1;
+                }
+                if(count == 0) {
+                    // cleaned through another fop sharing the cache
+                    dirty_pages.erase(p);
+                    continue;
+                }
+                next = first + count;
+
+                if(const auto e = write_pages(handle_data, first, count)) {
+                    logger(LogLevel::Error, "fs: failed to write back %lu pages of \"%s\": %d\n", count, name.data(), e.as_int());
+                    result          = result ? result : e;
+                    writeback_error = writeback_error ? writeback_error : e;
+                    continue;
+                }
+                for(auto i = first; i < first + count; i += 1) {
+                    cache_provider->at(i).state = CachePage::State::Clean;
+                    dirty_pages.erase(i);
+                }
+                dirty_page_count.fetch_sub(count);
+            }
+        }
+
+        if(const auto e = driver->destroy_handle_data(driver_data, handle_data)) {
+            logger(LogLevel::Error, "fs: failed to destroy handle data: %d\n", e.as_int());
+        }
+        return result;
+    }
+
+    // flushes and returns the first writeback error since the last sync
+    auto sync() -> Error {
+        flush();
+        return std::exchange(writeback_error, Error());
+    }
+
+    // takes this fop off its Writeback after writing it back, call with tree_mutex locked, defined in writeback.hpp
+    // returns false if a writeback pass is writing it, or if some pages failed and discard is not set
+    auto detach_writeback(bool discard) -> bool;
+
+    // waits for the writeback pass running on the driver of this fop, defined in writeback.hpp
+    auto wait_writeback() -> void;
+
+    // used by Writeback, returns false if pages were dirtied again meanwhile
+    auto finish_writeback() -> bool {
+        auto lock = cache_provider->lock();
+        if(!dirty_pages.empty()) {
+            return false;
+        }
+        writeback_queued = false;
+        return true;
+    }
+
+    // frames freed along with this file operator, caches shared with others are not counted
+    auto count_cached_pages() -> size_t {
+        if(!cache_provider || cache_provider.use_count() != 1) {
+            return 0;
+        }
+        auto lock  = cache_provider->lock();
+        auto count = size_t(0);
+        for(auto i = size_t(0); i < cache_provider->get_capacity(); i += 1) {
+            if(cache_provider->at(i).state != CachePage::State::Uninitialized) {
+                count += 1;
+            }
+        }
+        return count;
+    }
+
     FileOperator(FileOperator&& other)
         : driver(other.driver),
           driver_data(std::exchange(other.driver_data, 0)),
           cache_provider(std::move(other.cache_provider)),
+          critical_negatives(std::move(other.critical_negatives)),
           filesize(other.filesize),
           parent(other.parent),
           mount(other.mount),
@@ -391,6 +663,17 @@ class FileOperator {
     }
 
     ~FileOperator() {
+        // only removed files are destroyed with pages never written back
+        if(cache_provider && !dirty_pages.empty()) {
+            logger(LogLevel::Warn, "fs: dropping %lu dirty pages of \"%s\"\n", dirty_pages.size(), name.data());
+            auto lock = cache_provider->lock();
+            for(const auto p : dirty_pages) {
+                if(auto& cache = cache_provider->at(p); cache.state == CachePage::State::Dirty) {
+                    cache.state = CachePage::State::Clean;
+                    dirty_page_count.fetch_sub(1);
+                }
+            }
+        }
         if(driver_data != 0) {
             if(const auto e = driver->destroy_fop_data(driver_data)) {
                 logger(LogLevel::Error, "fs: failed to destroy driver data %d\n", e.as_int());
@@ -410,4 +693,76 @@ inline auto follow_mountpoints(FileOperator* fop) -> FileOperator* {
     }
     return fop;
 }
+
+inline auto FopLRU::release(FileOperator& fop, const bool cold) -> void {
+    if(fop.parent == nullptr || fop.attributes.volume_root || fop.attributes.keep_on_close) {
+        return;
+    }
+    const auto lock = mutex_like::AutoMutex(mutex);
+    if(cold) {
+        list.push_cold(fop);
+    } else {
+        list.touch(fop);
+    }
+}
+
+inline auto FopLRU::erase(FileOperator& fop) -> void {
+    const auto lock = mutex_like::AutoMutex(mutex);
+    list.erase(fop);
+}
+
+inline auto FopLRU::evict_children(FileOperator& dir, StringMap<FileOperator>& children) -> void {
+    for(auto p = children.begin(); p != children.end();) {
+        auto& child = p->second;
+        {
+            auto [lock, grandchildren] = child.critical_children.write_access();
+            evict_children(child, grandchildren);
+        }
+        dentry_cache->invalidate(&dir, p->first);
+        if(child.attributes.keep_on_close || child.is_used() || !child.detach_writeback(false) || child.has_dirty_pages()) {
+            p = std::next(p);
+            continue;
+        }
+        erase(child);
+        p = children.erase(p);
+    }
+}
+
+inline auto FopLRU::shrink(const size_t frames) -> size_t {
+    const auto tree_lock = SmartMutex(tree_mutex);
+
+    // evicting a file operator frees at least its own memory, even when its pages are already gone
+    auto freed   = size_t(0);
+    auto evicted = size_t(0);
+    while(freed < frames && evicted < frames) {
+        auto fop = (FileOperator*)(nullptr);
+        {
+            const auto lock = mutex_like::AutoMutex(mutex);
+            if(fop = list.get_coldest(); fop == nullptr) {
+                break;
+            }
+            list.erase(*fop);
+        }
+
+        // the tree mutex keeps fop and its parent in the tree
+        const auto parent              = fop->parent;
+        auto [children_lock, children] = parent->critical_children.write_access();
+        dentry_cache->invalidate(parent, fop->name);
+        if(fop->is_busy()) {
+            // opened again, or its children go first
+            continue;
+        }
+        freed += fop->count_cached_pages();
+        evicted += 1;
+        children.erase(children.find(fop->name));
+
+        if(children.empty()) {
+            auto [counts_lock, counts] = parent->critical_counts.write_access();
+            if(counts.read_count == 0 && counts.write_count == 0) {
+                release(*parent, true);
+            }
+        }
+    }
+    return freed;
+}
 } // namespace fs
@@ -12,7 +12,7 @@ constexpr auto open_wo = OpenMode{.read = false, .write = true};
 constexpr auto open_rw = OpenMode{.read = true, .write = true};
 
 inline auto try_open(fs::FileOperator* const fop, const OpenMode mode) -> Error {
-    auto [lock, counts] = fop->critical_counts.access();
+    auto [lock, counts] = fop->critical_counts.write_access();
 
     if(mode.read) {
         switch(fop->attributes.read_level) {
@@ -47,12 +47,16 @@ inline auto try_open(fs::FileOperator* const fop, const OpenMode mode) -> Error
         }
     }
 
+    const auto unused = counts.read_count == 0 && counts.write_count == 0;
     if(mode.read) {
         counts.read_count += 1;
     }
     if(mode.write) {
         counts.write_count += 1;
     }
+    if(unused) {
+        fop_lru->erase(*fop);
+    }
 
     return Success();
 }
@@ -88,28 +92,36 @@ class Handle {
             return Error::Code::FileNotOpened;
         }
 
-        auto created_fop = std::optional<FileOperator>();
-        auto result      = (FileOperator*)(nullptr);
+        // opening a cached child takes only the shared lock
+        auto result = (FileOperator*)(nullptr);
         {
-            auto [lock, children] = fop->critical_children.access();
-
-            const auto prepare_r = fop->prepare_fop(children, per_handle, name, created_fop);
-            if(!prepare_r) {
-                return prepare_r.as_error();
+            auto [lock, children] = fop->critical_children.read_access();
+            if(result = fop->find_child(children, name); result != nullptr) {
+                if(const auto e = try_open(result, open_mode)) {
+                    return e;
+                }
             }
-            const auto& prepare = prepare_r.as_value();
-
-            result = prepare;
+        }
 
-            if(const auto e = try_open(result, open_mode)) {
+        if(result == nullptr) {
+            auto load_r = fop->load_child(per_handle, name);
+            if(!load_r) {
+                return load_r.as_error();
+            }
+            auto& loaded = load_r.as_value();
+
+            // another thread may have cached the same child meanwhile
+            auto [lock, children] = fop->critical_children.write_access();
+            if(result = fop->find_child(children, name); result == nullptr) {
+                if(const auto e = try_open(&loaded, open_mode)) {
+                    return e;
+                }
+                result = fop->append_child(children, std::move(loaded));
+            } else if(const auto e = try_open(result, open_mode)) {
                 return e;
             }
         }
 
-        if(created_fop) {
-            result = fop->append_child(std::move(*created_fop));
-        }
-
         return Handle(result, open_mode);
     }
 
@@ -148,6 +160,11 @@ class Handle {
         return fop->remove(per_handle, name);
     }
 
+    // writes dirty cache pages back, returns the first writeback error since the last call
+    auto fsync() -> Error {
+        return fop->sync();
+    }
+
     auto get_filesize() const -> Result<size_t> {
         if(!mode.read) {
             return Error::Code::FileNotOpened;
@@ -1,11 +1,13 @@
 #pragma once
 #include "../block/drivers/ahci.hpp"
 #include "../block/gpt.hpp"
+#include "../rcu.hpp"
 #include "drivers/basic.hpp"
 #include "drivers/dev/driver.hpp"
 #include "drivers/fat/driver.hpp"
 #include "drivers/tmp.hpp"
 #include "handle.hpp"
+#include "writeback.hpp"
 
 namespace fs {
 struct SataDevice {
@@ -20,16 +22,18 @@ class Manager {
         std::string                   mountpoint_path;
         std::unique_ptr<Driver>       driver;
         std::unique_ptr<FileOperator> root;
+        std::unique_ptr<Writeback>    writeback; // null if the driver is shared
         Handle                        mountpoint_handle;
         bool                          shared_driver;
 
         auto operator=(MountRecord&&) -> MountRecord& = default;
 
-        MountRecord(std::string device, std::string mountpoint, Handle mountpoint_handle, Driver* const driver, FileOperator* const root, const bool shared_driver)
+        MountRecord(std::string device, std::string mountpoint, Handle mountpoint_handle, Driver* const driver, FileOperator* const root, Writeback* const writeback, const bool shared_driver)
             : device(std::move(device)),
               mountpoint_path(std::move(mountpoint)),
               driver(std::unique_ptr<Driver>(driver)),
               root(std::unique_ptr<FileOperator>(root)),
+              writeback(std::unique_ptr<Writeback>(writeback)),
               mountpoint_handle(std::move(mountpoint_handle)),
               shared_driver(shared_driver) {}
 
@@ -38,6 +42,9 @@ class Manager {
         }
 
         ~MountRecord() {
+            if(writeback) {
+                writeback->stop();
+            }
             if(shared_driver) {
                 [[maybe_unused]] const auto shared1 = driver.release();
                 [[maybe_unused]] const auto shared2 = root.release();
@@ -50,9 +57,15 @@ class Manager {
     FileOperator            basic_root;
     dev::Driver             devfs_driver;
     FileOperator            devfs_root;
+    Writeback               devfs_writeback;
     FileOperator&           root;
+    DentryCache             dentries;
+    FopLRU                  fops;
+    PageLRU                 pages;
+
+    using MountRecords = std::vector<std::shared_ptr<MountRecord>>;
 
-    Critical<std::vector<MountRecord>> critical_mount_records;
+    rcu::Protected<MountRecords> mount_records;
 
     static auto split_path(const std::string_view path) -> std::vector<std::string_view> {
         auto r = std::vector<std::string_view>();
@@ -78,35 +91,26 @@ class Manager {
         return r;
     }
 
-    auto open_root(const OpenMode mode) -> Result<Handle> {
-        auto fop = follow_mountpoints(&root);
-        if(const auto e = try_open(fop, mode)) {
-            return e;
-        }
-        auto handle = Handle(fop, mode);
-        return handle;
-    }
-
-    auto open_parent_directory(std::vector<std::string_view>& elms) -> Result<Handle> {
-        if(elms.empty()) {
-            return open_root(open_ro);
-        }
-
-        auto dirname = std::span<std::string_view>(elms.begin(), elms.size() - 1);
-        auto result  = open_root(open_ro);
-        if(!result) {
-            return result.as_error();
-        }
-
-        for(const auto& d : dirname) {
-            auto handle = std::move(result.as_value());
-            result      = handle.open(d, open_ro);
-            close(handle);
-            if(!result) {
-                return result;
+    // opens the deepest component of elms reachable through the dentry cache
+    // only that one is pinned, nothing keeps an unopened fop alive once the cache lock is released
+    auto open_cached(const std::span<const std::string_view> elms, const OpenMode mode, size_t& resolved) -> Result<Handle> {
+        auto fop      = follow_mountpoints(&root);
+        auto fop_mode = mode;
+        {
+            auto [lock, map] = dentries.read_access();
+            for(resolved = 0; resolved < elms.size(); resolved += 1) {
+                const auto child = DentryCache::find(map, fop, elms[resolved]);
+                if(child == nullptr) {
+                    break;
+                }
+                fop = follow_mountpoints(child);
+            }
+            fop_mode = resolved == elms.size() ? mode : open_ro;
+            if(const auto e = try_open(fop, fop_mode)) {
+                return e;
             }
         }
-        return result;
+        return Handle(fop, fop_mode);
     }
 
     auto set_mount_driver(const std::string_view path, FileOperator& root) -> Result<Handle> {
@@ -137,19 +141,20 @@ class Manager {
 
   public:
     auto open(const std::string_view path, const OpenMode mode) -> Result<Handle> {
-        auto elms = split_path(path);
-        if(elms.empty()) {
-            return open_root(mode);
-        }
-
-        const auto filename = elms.back();
-        auto       parent_r = open_parent_directory(elms);
-        if(!parent_r) {
-            return parent_r.as_error();
+        const auto elms     = split_path(path);
+        auto       resolved = size_t(0);
+        auto       result   = open_cached(elms, mode, resolved);
+
+        // the uncached rest is walked with handles and cached on the way
+        for(; result && resolved < elms.size(); resolved += 1) {
+            const auto name   = elms[resolved];
+            auto       handle = std::move(result.as_value());
+            result            = handle.open(name, resolved + 1 == elms.size() ? mode : open_ro);
+            if(result) {
+                dentries.insert(handle.fop, name, result.as_value().fop);
+            }
+            close(handle);
         }
-        auto& parent = parent_r.as_value();
-        auto  result = parent.open(filename, mode);
-        close(parent);
         return result;
     }
 
@@ -159,31 +164,23 @@ class Manager {
             return;
         }
 
-        auto fop = handle.fop;
+        const auto fop = handle.fop;
         fop->on_handle_destroy(handle.per_handle);
         if(const auto e = fop->destroy_per_handle(handle.per_handle)) {
             logger(LogLevel::Error, "fs: failed to destroy handle data: %d\n", e.as_int());
             return;
         }
 
-        {
-            auto [lock, counts] = fop->critical_counts.access();
-            if(handle.mode.read) {
-                counts.read_count -= 1;
-            }
-            if(handle.mode.write) {
-                counts.write_count -= 1;
-            }
+        auto [lock, counts] = fop->critical_counts.write_access();
+        if(handle.mode.read) {
+            counts.read_count -= 1;
         }
-        while(fop->parent != nullptr) {
-            if(fop->is_busy() || fop->attributes.volume_root || fop->attributes.keep_on_close) {
-                break;
-            }
-
-            const auto parent     = fop->parent;
-            auto [lock, children] = parent->critical_children.access();
-            children.erase(fop->name);
-            fop = parent;
+        if(handle.mode.write) {
+            counts.write_count -= 1;
+        }
+        // kept with its cache until the shrinker evicts it
+        if(counts.read_count == 0 && counts.write_count == 0) {
+            fops.release(*fop, false);
         }
     }
 
@@ -240,42 +237,103 @@ class Manager {
             }
         }
 
-        auto [lock, mount_records] = critical_mount_records.access();
-        mount_records.emplace_back(std::string(device), normalize_path(mountpoint_path), std::move(mountpoint_handle), driver.release(), root.release(), shared_driver);
-        return Success();
+        // devfs keeps the writeback of the manager
+        auto writeback = std::unique_ptr<Writeback>();
+        if(!shared_driver && driver->can_write_back()) {
+            writeback.reset(new Writeback());
+            if(const auto e = writeback->start()) {
+                logger(LogLevel::Error, "fs: failed to start writeback of %s: %d\n", std::string(device).data(), e.as_int());
+            }
+            driver->writeback = writeback.get();
+        }
+
+        auto record = std::make_shared<MountRecord>(std::string(device), normalize_path(mountpoint_path), std::move(mountpoint_handle), driver.release(), root.release(), writeback.release(), shared_driver);
+        return mount_records.update([&record](MountRecords& records) -> Error {
+            records.push_back(std::move(record));
+            return Success();
+        });
     }
 
     auto unmount(const std::string_view mountpoint_path) -> Error {
-        const auto path            = normalize_path(mountpoint_path);
-        auto [lock, mount_records] = critical_mount_records.access();
-        for(auto i = mount_records.rbegin(); i != mount_records.rend(); i += 1) {
-            if(i->mountpoint_path != path) {
-                continue;
+        const auto path = normalize_path(mountpoint_path);
+
+        // writes back outside of the update, which blocks every other mount table change
+        auto writeback = (Writeback*)(nullptr);
+        auto target    = std::shared_ptr<MountRecord>();
+        {
+            const auto guard = rcu::ReadGuard();
+            for(const auto& record : mount_records.read(guard)) {
+                if(record->mountpoint_path == path) {
+                    target    = record;
+                    writeback = record->driver->writeback;
+                }
             }
+        }
+        if(writeback != nullptr) {
+            if(const auto e = writeback->sync()) {
+                logger(LogLevel::Error, "fs: failed to write back %s: %d\n", target->device.data(), e.as_int());
+            }
+        }
 
-            auto&      mountpoint_handle = i->mountpoint_handle;
-            const auto mountpoint        = mountpoint_handle.fop;
+        // the record is destroyed after every reader has left it
+        return mount_records.update([this, &path](MountRecords& records) -> Error {
+            for(auto i = records.rbegin(); i != records.rend(); i += 1) {
+                auto& record = **i;
+                if(record.mountpoint_path != path) {
+                    continue;
+                }
+
+                auto&      mountpoint_handle = record.mountpoint_handle;
+                const auto mountpoint        = mountpoint_handle.fop;
 
-            const auto volume_root = mountpoint->mount;
-            if(volume_root->is_busy()) {
-                return Error::Code::VolumeBusy;
+                const auto volume_root = mountpoint->mount;
+                const auto tree_lock   = SmartMutex(fops.tree_mutex);
+                {
+                    // unused cached files do not keep the volume busy
+                    auto [lock, children] = volume_root->critical_children.write_access();
+                    fops.evict_children(*volume_root, children);
+                }
+                if(volume_root->is_busy()) {
+                    return Error::Code::VolumeBusy;
+                }
+                mountpoint->mount = nullptr;
+                // entries of the volume are not reachable anymore, but still point into it
+                dentries.clear();
+                close(record.mountpoint_handle);
+                records.erase(std::next(i).base());
+                return Success();
             }
-            mountpoint->mount = nullptr;
-            close(i->mountpoint_handle);
-            mount_records.erase(std::next(i).base());
-            return Success();
+
+            return Error::Code::NotMounted;
+        });
+    }
+
+    // writes dirty caches of every driver back, returns the first error
+    auto sync() -> Error {
+        auto records = MountRecords();
+        {
+            const auto guard = rcu::ReadGuard();
+            records          = mount_records.read(guard);
         }
 
-        return Error::Code::NotMounted;
+        auto result = devfs_writeback.sync();
+        for(const auto& record : records) {
+            if(record->writeback) {
+                const auto e = record->writeback->sync();
+                result       = result ? result : e;
+            }
+        }
+        return result;
     }
 
     auto get_mounts() const -> std::vector<std::array<std::string, 2>> {
-        auto [lock, mount_records] = critical_mount_records.access();
+        const auto  guard   = rcu::ReadGuard();
+        const auto& records = mount_records.read(guard);
 
-        auto r = std::vector<std::array<std::string, 2>>(mount_records.size());
-        for(auto i = 0; i < mount_records.size(); i += 1) {
-            r[i][0] = mount_records[i].device;
-            r[i][1] = mount_records[i].mountpoint_path;
+        auto r = std::vector<std::array<std::string, 2>>(records.size());
+        for(auto i = 0; i < records.size(); i += 1) {
+            r[i][0] = records[i]->device;
+            r[i][1] = records[i]->mountpoint_path;
         }
         return r;
     }
@@ -343,7 +401,17 @@ class Manager {
 
     Manager() : basic_root(basic_driver, basic_driver.get_root()),
                 devfs_root(devfs_driver, devfs_driver.get_root()),
-                root(basic_root) {}
+                root(basic_root) {
+        dentry_cache     = &dentries;
+        fop_lru          = &fops;
+        page_lru         = &pages;
+        dirty_page_limit = memory::get_usable_frames() * constants::writeback_dirty_ratio / 100;
+
+        devfs_driver.writeback = &devfs_writeback;
+        if(const auto e = devfs_writeback.start()) {
+            logger(LogLevel::Error, "fs: failed to start writeback of devfs: %d\n", e.as_int());
+        }
+    }
 };
 
 inline auto manager = (Manager*)(nullptr);
@@ -356,23 +424,19 @@ inline auto close(Handle& handle) -> void {
     return manager->close(handle);
 }
 
-inline auto device_finder_main(const uint64_t id, const int64_t data) -> void {
-    {
-        auto& ahci_controller = *reinterpret_cast<ahci::Controller*>(data);
-        auto  sata_devices    = std::vector<SataDevice>();
+// work item, ctx is the ahci::Controller
+inline auto find_devices(void* const ctx) -> void {
+    auto& ahci_controller = *static_cast<ahci::Controller*>(ctx);
+    auto  sata_devices    = std::vector<SataDevice>();
 
-        ahci_controller.wait_identify();
+    ahci_controller.wait_identify();
 
-        for(auto& dev : ahci_controller.get_devices()) {
-            sata_devices.emplace_back(SataDevice{block::ahci::Device(dev)});
-        }
-
-        // TODO
-        // pass exit code
-        [[maybe_unused]] const auto exit_code = manager->set_sata_devices(std::move(sata_devices)).as_int();
+    for(auto& dev : ahci_controller.get_devices()) {
+        sata_devices.emplace_back(SataDevice{block::ahci::Device(dev)});
     }
 
-    process::manager->post_kernel_message_with_cli(MessageType::DeviceFinderDone);
-    process::manager->exit_this_thread();
+    if(const auto e = manager->set_sata_devices(std::move(sata_devices))) {
+        logger(LogLevel::Error, "fs: failed to setup sata devices: %d\n", e.as_int());
+    }
 }
 } // namespace fs
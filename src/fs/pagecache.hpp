@@ -1,8 +1,14 @@
 #pragma once
+#include <deque>
+
 #include "../memory/frame.hpp"
+#include "../memory/shrinker.hpp"
 #include "../mutex.hpp"
+#include "../util/lru.hpp"
 
 namespace fs {
+class DefaultCacheProvider;
+
 struct CachePage {
     enum class State {
         Uninitialized,
@@ -11,7 +17,11 @@ struct CachePage {
     };
 
     memory::SmartSingleFrameID page;
-    State                      state = State::Uninitialized;
+    State                      state      = State::Uninitialized;
+    std::atomic_bool           referenced = false; // accessed since the last scan of PageLRU
+    bool                       active     = false; // guarded by PageLRU
+    DefaultCacheProvider*      owner      = nullptr;
+    LRUEntry<CachePage>        lru_entry;
 
     auto get_frame() -> std::byte* {
         return static_cast<std::byte*>(page->get_frame());
@@ -29,10 +39,77 @@ class CacheProvider {
     virtual ~CacheProvider() {}
 };
 
-class DefaultCacheProvider : public CacheProvider {
+// reclaimable cache pages of every file, on an active and an inactive list
+// loaded pages start inactive and are promoted by the scan only if they were referenced again,
+// so reading a large file once does not push out pages in repeated use
+class PageLRU : public memory::Shrinker {
   private:
-    Mutex                  mutex;
-    std::vector<CachePage> cache;
+    spinlock::SpinLock mutex;
+    LRUList<CachePage> active;
+    LRUList<CachePage> inactive;
+
+    auto list_of(CachePage& page) -> LRUList<CachePage>& {
+        return page.active ? active : inactive;
+    }
+
+    // keeps the active list at most as large as the inactive list
+    auto balance(const mutex_like::AutoMutex<spinlock::SpinLock>& /*lock*/) -> void {
+        while(active.size() > inactive.size()) {
+            auto& page = *active.get_coldest();
+            if(page.referenced.exchange(false)) {
+                active.touch(page);
+                continue;
+            }
+            active.erase(page);
+            page.active = false;
+            inactive.touch(page);
+        }
+    }
+
+    // unlinks the coldest unreferenced page, promoting referenced ones on the way
+    auto take_coldest(const mutex_like::AutoMutex<spinlock::SpinLock>& lock) -> CachePage* {
+        while(true) {
+            balance(lock);
+            const auto page = inactive.get_coldest();
+            if(page == nullptr) {
+                return nullptr;
+            }
+            inactive.erase(*page);
+            if(!page->referenced.exchange(false)) {
+                return page;
+            }
+            page->active = true;
+            active.touch(*page);
+        }
+    }
+
+  public:
+    // call with the owner of page locked, after the page is loaded
+    auto add(CachePage& page) -> void {
+        const auto lock = mutex_like::AutoMutex(mutex);
+        page.active     = false;
+        inactive.touch(page);
+    }
+
+    // call with the owner of page locked
+    auto remove(CachePage& page) -> void {
+        const auto lock = mutex_like::AutoMutex(mutex);
+        list_of(page).erase(page);
+    }
+
+    auto shrink(size_t frames) -> size_t override;
+};
+
+inline auto page_lru = (PageLRU*)(nullptr);
+
+// dirty pages of all files, writeback starts at once above the limit
+inline auto dirty_page_count = std::atomic_size_t(0);
+inline auto dirty_page_limit = size_t(-1);
+
+class DefaultCacheProvider : public CacheProvider, public std::enable_shared_from_this<DefaultCacheProvider> {
+  private:
+    Mutex                 mutex = Mutex(true); // handoff, so readers faulting pages in are not starved by new lockers
+    std::deque<CachePage> cache;                 // grows without moving pages, PageLRU links them
 
   public:
     auto lock() -> SmartMutex override {
@@ -48,7 +125,64 @@ class DefaultCacheProvider : public CacheProvider {
     }
 
     auto ensure_capacity(const size_t size) -> void override {
-        cache.resize(size);
+        for(auto i = cache.size(); i < size; i += 1) {
+            cache.emplace_back().owner = this;
+        }
+    }
+
+    ~DefaultCacheProvider() {
+        for(auto& page : cache) {
+            if(page.state != CachePage::State::Uninitialized) {
+                page_lru->remove(page);
+            }
+        }
     }
 };
+
+// scans the inactive list from its cold end and drops clean pages
+inline auto PageLRU::shrink(const size_t frames) -> size_t {
+    auto freed   = size_t(0);
+    auto scanned = size_t(0);
+    auto limit   = size_t(0);
+    {
+        const auto lock = mutex_like::AutoMutex(mutex);
+        limit           = active.size() + inactive.size();
+    }
+    while(freed < frames && scanned < limit) {
+        auto page  = (CachePage*)(nullptr);
+        auto owner = std::shared_ptr<DefaultCacheProvider>();
+        {
+            const auto lock = mutex_like::AutoMutex(mutex);
+            if(page = take_coldest(lock); page == nullptr) {
+                break;
+            }
+            // the owner is being destroyed if this fails, and unlinks its pages by itself
+            owner = page->owner->weak_from_this().lock();
+        }
+        scanned += 1;
+        if(!owner) {
+            continue;
+        }
+
+        // pages of a living owner are never moved nor freed
+        const auto lock = owner->lock();
+        switch(page->state) {
+        case CachePage::State::Uninitialized:
+            break;
+        case CachePage::State::Clean:
+            if(page->referenced.load()) {
+                add(*page);
+                break;
+            }
+            page->page  = memory::SmartSingleFrameID();
+            page->state = CachePage::State::Uninitialized;
+            freed += 1;
+            break;
+        case CachePage::State::Dirty:
+            add(*page);
+            break;
+        }
+    }
+    return freed;
+}
 } // namespace fs
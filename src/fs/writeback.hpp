@@ -0,0 +1,216 @@
+#pragma once
+#include <deque>
+
+#include "../constants.hpp"
+#include "fs.hpp"
+
+namespace fs {
+// writes dirty files of one driver back from its own thread
+// a file goes once its oldest dirty page is writeback_expire old, or at once while too many pages are dirty
+class Writeback {
+  private:
+    struct Entry {
+        FileOperator* fop;
+        uint64_t      dirtied; // tick
+    };
+
+    spinlock::SpinLock            mutex;
+    std::deque<Entry>             dirty;      // oldest first
+    Mutex                         pass_mutex; // held for a whole pass, so sync returns only after writes in flight
+    std::atomic<process::Thread*> thread   = nullptr;
+    std::atomic_bool              kicked   = false;
+    std::atomic_bool              stopping = false;
+    Event                         stopped;
+
+    static auto writeback_main(const uint64_t /*id*/, const int64_t data) -> void {
+        auto& self = *std::bit_cast<Writeback*>(data);
+        while(!self.stopping.load()) {
+            self.flush(self.kicked.exchange(false));
+            process::manager->wait_interrupt(self.get_deadline());
+        }
+        self.flush(true);
+        self.stopped.notify();
+        process::manager->exit_this_thread();
+    }
+
+    static auto get_expire() -> uint64_t {
+        return process::Manager::ms_to_tick(constants::writeback_expire);
+    }
+
+    auto get_deadline() -> uint64_t {
+        const auto lock = mutex_like::AutoMutex(mutex);
+        return dirty.empty() ? process::Manager::no_deadline : dirty.front().dirtied + get_expire();
+    }
+
+    auto pop(const bool all) -> FileOperator* {
+        const auto lock = mutex_like::AutoMutex(mutex);
+        if(dirty.empty() || (!all && dirty.front().dirtied + get_expire() > process::manager->get_tick())) {
+            return nullptr;
+        }
+        const auto fop = dirty.front().fop;
+        dirty.pop_front();
+        return fop;
+    }
+
+    auto write_back(FileOperator& fop) -> Error {
+        const auto error = fop.flush();
+
+        // the tree mutex keeps the shrinker off the fop until it is back on the lru
+        const auto tree_lock = SmartMutex(fop_lru->tree_mutex);
+        if(!fop.finish_writeback()) {
+            const auto lock = mutex_like::AutoMutex(mutex);
+            dirty.push_back(Entry{&fop, process::manager->get_tick()});
+            return error;
+        }
+        auto [lock, counts] = fop.critical_counts.write_access();
+        if(counts.read_count == 0 && counts.write_count == 0) {
+            fop_lru->release(fop, false);
+        }
+        return error;
+    }
+
+    auto flush(const bool all) -> Error {
+        const auto pass_lock = SmartMutex(pass_mutex);
+
+        auto queued = size_t(0);
+        {
+            const auto lock = mutex_like::AutoMutex(mutex);
+            queued          = dirty.size();
+        }
+
+        // files requeued because their pages failed wait for the next pass
+        auto result = Error();
+        for(; queued != 0; queued -= 1) {
+            const auto fop = pop(all);
+            if(fop == nullptr) {
+                break;
+            }
+            if(const auto e = write_back(*fop)) {
+                result = result ? result : e;
+            }
+        }
+        return result;
+    }
+
+  public:
+    // call with the cache of fop locked, after setting its writeback_queued
+    auto add(FileOperator& fop) -> void {
+        auto was_empty = false;
+        {
+            const auto lock = mutex_like::AutoMutex(mutex);
+            was_empty       = dirty.empty();
+            dirty.push_back(Entry{&fop, process::manager->get_tick()});
+        }
+        // otherwise the thread already waits for the oldest one
+        if(was_empty) {
+            if(const auto t = thread.load(); t != nullptr) {
+                process::manager->notify_interrupt(t);
+            }
+        }
+    }
+
+    // takes fop off the queue, returns false if a pass is writing it back
+    // call with the cache of fop locked
+    auto cancel(const FileOperator& fop) -> bool {
+        const auto lock = mutex_like::AutoMutex(mutex);
+        const auto p    = std::find_if(dirty.begin(), dirty.end(), [&fop](const Entry& entry) { return entry.fop == &fop; });
+        if(p == dirty.end()) {
+            return false;
+        }
+        dirty.erase(p);
+        return true;
+    }
+
+    // returns once the running pass is over
+    auto wait() -> void {
+        const auto pass_lock = SmartMutex(pass_mutex);
+    }
+
+    // writes everything back without waiting for expiry
+    auto kick() -> void {
+        if(const auto t = thread.load(); t != nullptr) {
+            kicked = true;
+            process::manager->notify_interrupt(t);
+        }
+    }
+
+    // writes everything back in the calling thread
+    auto sync() -> Error {
+        return flush(true);
+    }
+
+    auto start() -> Error {
+        const auto r = process::manager->create_interrupt_thread(writeback_main, std::bit_cast<int64_t>(this), 0, process::any_processor, process::SchedulingPolicy::Fair);
+        if(!r) {
+            return r.as_error();
+        }
+        thread.store(r.as_value());
+        return Success();
+    }
+
+    // writes what is left back and ends the thread, call before destruction
+    auto stop() -> void {
+        if(const auto t = thread.load(); t != nullptr) {
+            stopping = true;
+            process::manager->notify_interrupt(t);
+            stopped.wait();
+        }
+    }
+};
+
+inline auto FileOperator::detach_writeback(const bool discard) -> bool {
+    if(!writeback_queued.load()) {
+        return true;
+    }
+    flush();
+
+    auto lock = cache_provider->lock();
+    if(!discard && !dirty_pages.empty()) {
+        return false;
+    }
+    if(!driver->writeback->cancel(*this)) {
+        return false;
+    }
+    for(const auto p : dirty_pages) {
+        if(auto& cache = cache_provider->at(p); cache.state == CachePage::State::Dirty) {
+            cache.state = CachePage::State::Clean;
+            dirty_page_count.fetch_sub(1);
+        }
+    }
+    dirty_pages.clear();
+    writeback_queued = false;
+    return true;
+}
+
+inline auto FileOperator::wait_writeback() -> void {
+    if(const auto writeback = driver->writeback; writeback != nullptr) {
+        writeback->wait();
+    }
+}
+
+inline auto FileOperator::mark_dirty(const size_t begin, const size_t end) -> void {
+    auto dirtied = size_t(0);
+    for(auto p = begin; p < end; p += 1) {
+        auto& cache = cache_provider->at(p);
+        if(cache.state == CachePage::State::Clean) {
+            cache.state = CachePage::State::Dirty;
+            dirtied += 1;
+        }
+        dirty_pages.insert(p);
+    }
+    // flush subtracts every page it cleans, with or without a Writeback
+    const auto total = dirty_page_count.fetch_add(dirtied) + dirtied;
+
+    const auto writeback = driver->writeback;
+    if(writeback == nullptr) {
+        // written back only by sync()
+        return;
+    }
+    if(!writeback_queued.exchange(true)) {
+        writeback->add(*this);
+    }
+    if(total > dirty_page_limit) {
+        writeback->kick();
+    }
+}
+} // namespace fs
@@ -3,6 +3,7 @@
 #include "../log.hpp"
 #include "../process/manager.hpp"
 #include "../segment/segment.hpp"
+#include "stats.hpp"
 #include "type.hpp"
 
 namespace interrupt {
@@ -17,8 +18,10 @@ inline auto print_stackframe(const InterruptFrame& frame) -> void {
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Winterrupt-service-routine"
 
-#define int_handler_with_error(name)                                                                                          \
+#define int_handler_with_error(name, vector)                                                                                  \
     __attribute__((interrupt)) static auto int_handler_##name(InterruptFrame* const frame, const uint64_t error_code)->void { \
+        const auto gs = smp::KernelGSGuard(frame->cs);                                                                        \
+        count_interrupt(vector);                                                                                              \
         try_kill_app(*frame, #name);                                                                                          \
         debug::println("interrupt(" #name ")");                                                                               \
         debug::println("code: ", error_code);                                                                                 \
@@ -28,8 +31,10 @@ inline auto print_stackframe(const InterruptFrame& frame) -> void {
         }                                                                                                                     \
     }
 
-#define int_handler(name)                                                                          \
+#define int_handler(name, vector)                                                                  \
     __attribute__((interrupt)) static auto int_handler_##name(InterruptFrame* const frame)->void { \
+        const auto gs = smp::KernelGSGuard(frame->cs);                                             \
+        count_interrupt(vector);                                                                   \
         try_kill_app(*frame, #name);                                                               \
         debug::println("interrupt(" #name ")");                                                    \
         print_stackframe(*frame);                                                                  \
@@ -46,27 +51,26 @@ __attribute__((no_caller_saved_registers)) inline auto try_kill_app(const Interr
     process::manager->exit_this_thread();
 }
 
-int_handler(divide_error);
-int_handler(debug);
-int_handler(nmi);
-int_handler(breakpoint);
-int_handler(overflow);
-int_handler(bound_range_exceeded);
-int_handler(invalid_opcode);
-int_handler(device_not_available);
-int_handler_with_error(double_fault);
-int_handler(coprocessor_segment_overrun);
-int_handler_with_error(invalid_tss);
-int_handler_with_error(segment_not_present);
-int_handler_with_error(stack_fault);
-int_handler_with_error(general_protection);
-int_handler_with_error(page_fault);
-int_handler(fpu_floating_point);
-int_handler_with_error(alignment_check);
-int_handler(machine_check);
-int_handler(simd_floating_point);
-int_handler(virtualization);
-int_handler_with_error(control_protection);
+int_handler(divide_error, 0);
+int_handler(debug, 1);
+int_handler(nmi, 2);
+int_handler(breakpoint, 3);
+int_handler(overflow, 4);
+int_handler(bound_range_exceeded, 5);
+int_handler(invalid_opcode, 6);
+int_handler_with_error(double_fault, 8);
+int_handler(coprocessor_segment_overrun, 9);
+int_handler_with_error(invalid_tss, 10);
+int_handler_with_error(segment_not_present, 11);
+int_handler_with_error(stack_fault, 12);
+int_handler_with_error(general_protection, 13);
+int_handler_with_error(page_fault, 14);
+int_handler(fpu_floating_point, 16);
+int_handler_with_error(alignment_check, 17);
+int_handler(machine_check, 18);
+int_handler(simd_floating_point, 19);
+int_handler(virtualization, 20);
+int_handler_with_error(control_protection, 21);
 
 #undef int_handler_with_error
 #undef int_handler
@@ -3,8 +3,8 @@
 #include <cstdint>
 #include <deque>
 
-#include "../message.hpp"
 #include "fault_handlers.hpp"
+#include "irq.hpp"
 #include "type.hpp"
 
 namespace interrupt {
@@ -32,24 +32,20 @@ __attribute__((no_caller_saved_registers)) inline auto notify_end_of_interrupt()
     lapic::get_registers().end_of_interrupt = 0;
 }
 
-__attribute__((interrupt)) static auto int_handler_xhci(InterruptFrame* const frame) -> void {
-    process::manager->post_kernel_message(MessageType::XHCIInterrupt);
+template <size_t vector>
+__attribute__((interrupt)) static auto int_handler_threaded(InterruptFrame* const frame) -> void {
+    const auto gs   = smp::KernelGSGuard(frame->cs);
+    const auto stat = StatScope(vector);
+    if(const auto handler = threaded_handlers[smp::get_processor_number()][vector].load()) {
+        handler->notify();
+    }
     notify_end_of_interrupt();
 }
 
-__attribute__((interrupt)) static auto int_handler_ahci(InterruptFrame* const frame) -> void {
-    process::manager->post_kernel_message(MessageType::AHCIInterrupt);
-    notify_end_of_interrupt();
-}
-
-__attribute__((interrupt)) static auto int_handler_virtio_gpu_control(InterruptFrame* const frame) -> void {
-    process::manager->post_kernel_message(MessageType::VirtIOGPUControl);
-    notify_end_of_interrupt();
-}
-
-__attribute__((interrupt)) static auto int_handler_virtio_gpu_cursor(InterruptFrame* const frame) -> void {
-    process::manager->post_kernel_message(MessageType::VirtIOGPUCursor);
-    notify_end_of_interrupt();
+template <size_t... offsets>
+auto set_threaded_idt_entries(InterruptDescriptorTable& idt, const uint16_t cs, std::index_sequence<offsets...>) -> void {
+    const auto attr = make_idt_attr(DescriptorType::InterruptGate, 0);
+    (set_idt_entry(idt, Vector(Vector::DynamicBegin + offsets), attr, reinterpret_cast<uint64_t>(int_handler_threaded<Vector::DynamicBegin + offsets>), cs), ...);
 }
 
 } // namespace internal
@@ -70,8 +66,8 @@ inline auto initialize(InterruptDescriptorTable& idt) -> void {
     sie(4, int_handler_overflow);
     sie(5, int_handler_bound_range_exceeded);
     sie(6, int_handler_invalid_opcode);
-    sie(7, int_handler_device_not_available);
-    sie(8, int_handler_double_fault);
+    sie(7, int_handler_device_not_available_entry);
+    sie_ist(8, int_handler_double_fault, ist_for_double_fault);
     sie(9, int_handler_coprocessor_segment_overrun);
     sie(10, int_handler_invalid_tss);
     sie(11, int_handler_segment_not_present);
@@ -85,11 +81,9 @@ inline auto initialize(InterruptDescriptorTable& idt) -> void {
     sie(20, int_handler_virtualization);
     sie(21, int_handler_control_protection);
 
-    sie(Vector::XHCI, internal::int_handler_xhci);
     sie_ist(Vector::LAPICTimer, int_handler_lapic_timer_entry, ist_for_lapic_timer);
-    sie(Vector::AHCI, internal::int_handler_ahci);
-    sie(Vector::VirtIOGPUControl, internal::int_handler_virtio_gpu_control);
-    sie(Vector::VirtIOGPUCursor, internal::int_handler_virtio_gpu_cursor);
+    sie_ist(Vector::Reschedule, int_handler_reschedule_entry, ist_for_lapic_timer);
+    internal::set_threaded_idt_entries(idt, cs, std::make_index_sequence<internal::dynamic_vector_count>());
     load_idt(sizeof(idt.data) - 1, reinterpret_cast<uintptr_t>(idt.data.data()));
 
 #undef sie
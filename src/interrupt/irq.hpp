@@ -0,0 +1,189 @@
+#pragma once
+#include <bitset>
+
+#include "../pci.hpp"
+#include "../util/spinlock.hpp"
+#include "threaded.hpp"
+#include "vector.hpp"
+
+namespace interrupt {
+enum class MSIType {
+    MSI,
+    MSIX,
+};
+
+// a message signaled interrupt of a device
+// the vector is allocated on the processor the interrupt is routed to
+struct IRQ {
+    const pci::Device* device;
+    MSIType            type;
+    unsigned int       entry = 0; // msix table entry
+
+    ThreadedHandler*     handler   = nullptr;
+    smp::ProcessorNumber processor = smp::invalid_processor_number;
+    Vector               vector    = Vector(0);
+};
+
+namespace internal {
+constexpr auto dynamic_vector_count = size_t(Vector::DynamicEnd - Vector::DynamicBegin);
+
+// read by the hard interrupt handlers, indexed by [processor][vector]
+inline auto threaded_handlers = std::array<std::array<std::atomic<ThreadedHandler*>, 256>, smp::max_processors>();
+} // namespace internal
+
+// assigns vectors from per-processor pools and spreads device interrupts over processors
+class IRQManager {
+  private:
+    using VectorBitmap = std::bitset<internal::dynamic_vector_count>;
+
+    spinlock::SpinLock                            mutex;
+    std::array<VectorBitmap, smp::max_processors> used_vectors;
+    std::vector<IRQ*>                             irqs;
+    process::AffinityMask                         isolated = 0; // processors balance() keeps free
+
+    auto allocate_vector(const smp::ProcessorNumber processor) -> Result<Vector> {
+        auto& used = used_vectors[processor];
+        for(auto i = size_t(0); i < used.size(); i += 1) {
+            if(!used[i]) {
+                used[i] = true;
+                return Vector(Vector::DynamicBegin + i);
+            }
+        }
+        return Error::Code::Full;
+    }
+
+    auto free_vector(const smp::ProcessorNumber processor, const Vector vector) -> void {
+        used_vectors[processor][vector - Vector::DynamicBegin] = false;
+    }
+
+    static auto program(const IRQ& irq, const smp::ProcessorNumber processor, const Vector vector) -> Error {
+        const auto lapic_id = smp::per_cpus[processor].lapic_id;
+        switch(irq.type) {
+        case MSIType::MSI:
+            return irq.device->configure_msi_fixed_destination(lapic_id, pci::MSITriggerMode::Level, pci::MSIDeliveryMode::Fixed, vector, 0);
+        case MSIType::MSIX:
+            return irq.device->configure_msix_fixed_destination(lapic_id, pci::MSITriggerMode::Level, pci::MSIDeliveryMode::Fixed, vector, irq.entry);
+        }
+        return Error::Code::NoPCIMSI;
+    }
+
+    auto set_affinity(const mutex_like::AutoMutex<spinlock::SpinLock>& /*lock*/, IRQ& irq, const smp::ProcessorNumber processor) -> Error {
+        if(processor >= process::manager->get_processor_count()) {
+            return Error::Code::InvalidAffinity;
+        }
+        if(processor == irq.processor) {
+            return Success();
+        }
+
+        const auto vector_r = allocate_vector(processor);
+        if(!vector_r) {
+            return vector_r.as_error();
+        }
+        const auto vector = vector_r.as_value();
+
+        // the new route is ready before the device uses it
+        internal::threaded_handlers[processor][vector].store(irq.handler);
+        if(const auto e = program(irq, processor, vector)) {
+            internal::threaded_handlers[processor][vector].store(nullptr);
+            free_vector(processor, vector);
+            return e;
+        }
+
+        if(irq.processor != smp::invalid_processor_number) {
+            internal::threaded_handlers[irq.processor][irq.vector].store(nullptr);
+            free_vector(irq.processor, irq.vector);
+        }
+        irq.processor = processor;
+        irq.vector    = vector;
+
+        // an interrupt in flight may have hit the old vector
+        if(irq.handler != nullptr) {
+            irq.handler->notify();
+        }
+        return Success();
+    }
+
+    auto count_irqs_on(const smp::ProcessorNumber processor) const -> size_t {
+        return std::count_if(irqs.begin(), irqs.end(), [processor](const IRQ* const irq) { return irq->processor == processor; });
+    }
+
+    auto select_processor(const smp::ProcessorNumber exclude) const -> smp::ProcessorNumber {
+        const auto processor_count = process::manager->get_processor_count();
+
+        auto result = smp::invalid_processor_number;
+        auto min    = size_t(-1);
+        for(auto p = processor_count; p > 0; p -= 1) {
+            const auto processor = p - 1;
+            if(processor == exclude || (isolated & process::processor_to_affinity(processor))) {
+                continue;
+            }
+            if(const auto num = count_irqs_on(processor); num < min) {
+                min    = num;
+                result = processor;
+            }
+        }
+        // every processor is isolated
+        return result == smp::invalid_processor_number ? 0 : result;
+    }
+
+  public:
+    // routes irq to the least loaded processor
+    auto add(IRQ& irq) -> Error {
+        const auto lock = mutex_like::AutoMutex(mutex);
+        if(const auto e = set_affinity(lock, irq, select_processor(smp::invalid_processor_number))) {
+            return e;
+        }
+        irqs.push_back(&irq);
+        return Success();
+    }
+
+    auto attach(IRQ& irq, ThreadedHandler& handler) -> void {
+        const auto lock = mutex_like::AutoMutex(mutex);
+        irq.handler     = &handler;
+        if(irq.processor != smp::invalid_processor_number) {
+            internal::threaded_handlers[irq.processor][irq.vector].store(&handler);
+        }
+    }
+
+    auto set_affinity(IRQ& irq, const smp::ProcessorNumber processor) -> Error {
+        const auto lock = mutex_like::AutoMutex(mutex);
+        return set_affinity(lock, irq, processor);
+    }
+
+    auto set_isolated(const process::AffinityMask mask) -> void {
+        const auto lock = mutex_like::AutoMutex(mutex);
+        isolated        = mask;
+    }
+
+    // moves irqs off isolated or crowded processors, call after new processors come online
+    auto balance() -> void {
+        const auto lock = mutex_like::AutoMutex(mutex);
+        for(const auto irq : irqs) {
+            const auto current = irq->processor;
+            const auto target  = select_processor(current);
+            if(!(isolated & process::processor_to_affinity(current)) && count_irqs_on(target) + 1 >= count_irqs_on(current)) {
+                continue;
+            }
+            if(const auto e = set_affinity(lock, *irq, target)) {
+                logger(LogLevel::Error, "interrupt: failed to move irq to processor %lu: %d\n", target, e.as_int());
+            }
+        }
+    }
+
+    auto get_irqs() -> std::vector<IRQ> {
+        const auto lock   = mutex_like::AutoMutex(mutex);
+        auto       result = std::vector<IRQ>();
+        for(const auto irq : irqs) {
+            result.push_back(*irq);
+        }
+        return result;
+    }
+
+    auto find(const size_t index) -> IRQ* {
+        const auto lock = mutex_like::AutoMutex(mutex);
+        return index < irqs.size() ? irqs[index] : nullptr;
+    }
+};
+
+inline auto irq_manager = (IRQManager*)(nullptr);
+} // namespace interrupt
@@ -0,0 +1,47 @@
+#pragma once
+#include <array>
+#include <atomic>
+
+#include "../arch/amd64/tsc.hpp"
+#include "../smp/id.hpp"
+
+namespace interrupt {
+// per processor, per vector interrupt statistics
+// each slot is written only by its own processor with interrupts disabled,
+// so plain loads and stores are enough, atomics only keep readers on other processors tear free
+struct VectorStat {
+    std::atomic_uint64_t count  = 0;
+    std::atomic_uint64_t cycles = 0; // tsc cycles spent in the handler
+};
+
+using VectorStats = std::array<VectorStat, 256>;
+
+inline auto stats = std::array<VectorStats, smp::max_processors>();
+
+namespace internal {
+inline auto add_relaxed(std::atomic_uint64_t& value, const uint64_t delta) -> void {
+    value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+} // namespace internal
+
+// counts for handlers which never return, such as faults
+inline auto count_interrupt(const size_t vector) -> void {
+    internal::add_relaxed(stats[smp::get_processor_number()][vector].count, 1);
+}
+
+// counts on construction and accounts the elapsed cycles on destruction
+class StatScope {
+  private:
+    VectorStat& stat;
+    uint64_t    begin;
+
+  public:
+    StatScope(const size_t vector) : stat(stats[smp::get_processor_number()][vector]), begin(amd64::read_tsc()) {
+        internal::add_relaxed(stat.count, 1);
+    }
+
+    ~StatScope() {
+        internal::add_relaxed(stat.cycles, amd64::read_tsc() - begin);
+    }
+};
+} // namespace interrupt
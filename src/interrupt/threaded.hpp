@@ -0,0 +1,48 @@
+#pragma once
+#include "../process/manager.hpp"
+
+namespace interrupt {
+// device interrupt serviced by its own kernel thread
+// the hard interrupt handler only acknowledges the interrupt and wakes the thread
+// routed to a device by IRQManager::attach
+class ThreadedHandler {
+  public:
+    using Handler = void(void* data);
+
+  private:
+    Handler*         handler;
+    void*            data;
+    process::Thread* thread = nullptr;
+
+    static auto main(const uint64_t /*id*/, const int64_t data) -> void {
+        auto& self = *std::bit_cast<ThreadedHandler*>(data);
+        while(true) {
+            // interrupts raised before the thread started are handled here too
+            self.handler(self.data);
+            process::manager->wait_interrupt();
+        }
+    }
+
+  public:
+    auto start(const process::Nice nice, const process::AffinityMask affinity = process::any_processor) -> Error {
+        auto r = process::manager->create_interrupt_thread(main, std::bit_cast<int64_t>(this), nice, affinity);
+        if(!r) {
+            return r.as_error();
+        }
+        thread = r.as_value();
+        return Success();
+    }
+
+    // for hard interrupt handlers
+    auto notify() -> void {
+        if(thread != nullptr) {
+            process::manager->notify_interrupt(thread);
+        }
+    }
+
+    ThreadedHandler(const ThreadedHandler&) = delete;
+
+    ThreadedHandler(Handler* const handler, void* const data) : handler(handler), data(data) {
+    }
+};
+} // namespace interrupt
@@ -38,5 +38,6 @@ struct InterruptDescriptorTable {
     std::array<InterruptDescriptor, 256> data;
 };
 
-constexpr auto ist_for_lapic_timer = 1;
+constexpr auto ist_for_lapic_timer  = 1;
+constexpr auto ist_for_double_fault = 2; // kernel stack overflow hits a guard page
 } // namespace interrupt
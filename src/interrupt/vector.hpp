@@ -2,10 +2,11 @@
 
 namespace interrupt {
 enum Vector {
-    XHCI = 0x40,
-    LAPICTimer,
-    AHCI,
-    VirtIOGPUControl,
-    VirtIOGPUCursor,
+    LAPICTimer = 0x40,
+    Reschedule = 0x41, // ipi to a processor which has to pick a woken thread
+
+    // device interrupts, allocated per processor by IRQManager
+    DynamicBegin = 0x50,
+    DynamicEnd   = 0xF0,
 };
 } // namespace interrupt
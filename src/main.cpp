@@ -2,6 +2,7 @@
 #include "ahci/ahci.hpp"
 #include "debug.hpp"
 #include "devfs/framebuffer.hpp"
+#include "devfs/interrupts.hpp"
 #include "fs/manager.hpp"
 #include "interrupt/interrupt.hpp"
 #include "keyboard.hpp"
@@ -18,6 +19,7 @@
 #include "usb/classdriver/hid.hpp"
 #include "usb/xhci/xhci.hpp"
 #include "virtio/gpu.hpp"
+#include "workqueue.hpp"
 
 class Kernel {
   private:
@@ -81,13 +83,14 @@ class Kernel {
         return PCIScanResult{.devices = std::move(devices), .xhc = xhc, .virtio_gpu = virtio_gpu, .ahci = ahci};
     }
 
-    static auto setup_xhc(const pci::Device& dev) -> std::optional<std::unique_ptr<usb::xhci::Controller>> {
-        const auto bsp_local_apic_id = *reinterpret_cast<const uint32_t*>(0xFEE00020) >> 24;
-
-        if(dev.configure_msi_fixed_destination(bsp_local_apic_id, pci::MSITriggerMode::Level, pci::MSIDeliveryMode::Fixed, interrupt::Vector::XHCI, 0) &&
-           dev.configure_msix_fixed_destination(bsp_local_apic_id, pci::MSITriggerMode::Level, pci::MSIDeliveryMode::Fixed, interrupt::Vector::XHCI, 0)) {
-            logger(LogLevel::Error, "kernel: failed to configure msi for xHC device");
-            return std::nullopt;
+    static auto setup_xhc(const pci::Device& dev, interrupt::IRQ& irq) -> std::optional<std::unique_ptr<usb::xhci::Controller>> {
+        irq = interrupt::IRQ{.device = &dev, .type = interrupt::MSIType::MSI};
+        if(interrupt::irq_manager->add(irq)) {
+            irq = interrupt::IRQ{.device = &dev, .type = interrupt::MSIType::MSIX};
+            if(interrupt::irq_manager->add(irq)) {
+                logger(LogLevel::Error, "kernel: failed to configure msi for xHC device");
+                return std::nullopt;
+            }
         }
 
         // find mmio address of xhc device
@@ -129,6 +132,7 @@ class Kernel {
         auto& processor_resource = *parameter->processor_resource;
         parameter->notify        = 1;
         apply_segments(processor_resource.gdt);
+        smp::initialize_per_cpu_by_lapic_id();
 
         auto tss_resource = segment::TSSResource();
         if(auto r = segment::setup_tss(processor_resource.gdt); !r) {
@@ -226,6 +230,7 @@ class Kernel {
         // - setup segmentaion
         segment::create_segments(processor_resource.gdt);
         segment::apply_segments(processor_resource.gdt);
+        smp::initialize_per_cpu(0);
         // - setup paging
         static auto temporary_pml4 = paging::PageMapLevel4Table();
         {
@@ -252,7 +257,8 @@ class Kernel {
             }
         }
 
-        auto critical_allocator    = Critical<memory::BitmapMemoryManager*>(&memory_manager);
+        // allocations are short and frequent, hand the lock to the woken waiter instead of letting it race with new lockers
+        auto critical_allocator    = Critical<memory::BitmapMemoryManager*>(mutex_like::mutex_option, true, &memory_manager);
         memory::critical_allocator = &critical_allocator;
 
         // create task manager
@@ -260,8 +266,29 @@ class Kernel {
         auto pm          = process::Manager();
         process::manager = &pm;
 
+        // create interrupt router
+        auto irq_manager       = interrupt::IRQManager();
+        interrupt::irq_manager = &irq_manager;
+
+        // create deferred work queue
+        auto system_workqueue   = workqueue::WorkQueue(constants::system_workqueue_workers);
+        workqueue::system_queue = &system_workqueue;
+
+        // create memory reclaimer
+        auto reclaimer = memory::Reclaimer();
+        if(const auto e = reclaimer.start()) {
+            fatal_error("failed to start memory reclaimer: ", e.as_int());
+        }
+        memory::reclaimer = &reclaimer;
+
         // create filesystem mananger
         fs::manager = new fs::Manager();
+        // clean pages go before the file operators holding them
+        for(const auto shrinker : std::array<memory::Shrinker*, 2>{fs::page_lru, fs::fop_lru}) {
+            if(const auto e = reclaimer.add(*shrinker)) {
+                logger(LogLevel::Error, "kernel: failed to register file cache shrinker: %d\n", e.as_int());
+            }
+        }
 
         // - mount "/dev"
         if(const auto e = fs::manager->mount("devfs", "/dev")) {
@@ -274,6 +301,12 @@ class Kernel {
             fatal_error("failed to create uefi framebuffer");
         }
 
+        // create interrupt statistics
+        auto interrupt_stats = devfs::InterruptStats();
+        if(const auto e = fs::manager->create_device_file("interrupts", &interrupt_stats)) {
+            logger(LogLevel::Error, "kernel: failed to create interrupt statistics device file: %d\n", e.as_int());
+        }
+
         // initialize tss
         if(auto r = segment::setup_tss(processor_resource.gdt); !r) {
             fatal_error("failed to setup tss: ", r.as_error().as_int());
@@ -296,13 +329,18 @@ class Kernel {
         // - setup pci devices
         const auto pci_devices = scan_pci_devices();
 
+        auto xhc_irq                = interrupt::IRQ();
+        auto sata_irq               = interrupt::IRQ();
+        auto virtio_gpu_control_irq = interrupt::IRQ();
+        auto virtio_gpu_cursor_irq  = interrupt::IRQ();
+
         // -- setup xhc
         auto xhc = std::unique_ptr<usb::xhci::Controller>();
         if(pci_devices.xhc != nullptr) {
             if(pci_devices.xhc->read_vender_id() == 0x8086) {
                 switch_ehci_to_xhci(pci_devices.devices, *pci_devices.xhc);
             }
-            if(auto x = setup_xhc(*pci_devices.xhc)) {
+            if(auto x = setup_xhc(*pci_devices.xhc, xhc_irq)) {
                 xhc = std::move(*x);
                 usb_keyboard.reset(new devfs::USBKeyboard());
             }
@@ -325,7 +363,7 @@ class Kernel {
         // -- setup virtio gpu
         auto virtio_gpu = std::unique_ptr<virtio::gpu::GPUDevice>();
         if(pci_devices.virtio_gpu != nullptr) {
-            if(auto result = virtio::gpu::initialize(*pci_devices.virtio_gpu)) {
+            if(auto result = virtio::gpu::initialize(*pci_devices.virtio_gpu, virtio_gpu_control_irq, virtio_gpu_cursor_irq)) {
                 virtio_gpu = std::move(result.as_value());
             } else {
                 logger(LogLevel::Error, "kernel: failed to initilize virtio gpu: %d", result.as_error());
@@ -337,17 +375,51 @@ class Kernel {
         // -- setup sata devices
         auto sata_controller = std::unique_ptr<ahci::Controller>();
         if(pci_devices.ahci != nullptr) {
-            sata_controller = ahci::initialize(*pci_devices.ahci);
+            sata_controller = ahci::initialize(*pci_devices.ahci, sata_irq);
         }
 
-        const auto kernel_pid           = process::manager->get_this_thread()->process->id;
-        auto       fs_device_finder_tid = process::ThreadID();
+        // - start interrupt threads
+        auto xhc_interrupt = interrupt::ThreadedHandler(
+            [](void* const data) {
+                auto& xhc = *static_cast<usb::xhci::Controller*>(data);
+                while(xhc.has_unprocessed_event()) {
+                    if(const auto error = xhc.process_event()) {
+                        logger(LogLevel::Error, "kernel: failed to process xhc event: %d\n", error);
+                    }
+                }
+            },
+            xhc.get());
+        auto sata_interrupt = interrupt::ThreadedHandler(
+            [](void* const data) {
+                static_cast<ahci::Controller*>(data)->on_interrupt();
+            },
+            sata_controller.get());
+        auto virtio_gpu_control_interrupt = interrupt::ThreadedHandler(
+            [](void* const data) {
+                if(const auto e = static_cast<virtio::gpu::GPUDevice*>(data)->process_control_queue()) {
+                    logger(LogLevel::Error, "kernel: failed to process virtio gpu event: %d\n", e.as_int());
+                }
+            },
+            virtio_gpu.get());
+        const auto start_interrupt_thread = [](interrupt::ThreadedHandler& handler, interrupt::IRQ& irq, const process::Nice nice) {
+            if(const auto e = handler.start(nice)) {
+                logger(LogLevel::Error, "kernel: failed to start interrupt thread: %d\n", e.as_int());
+                return;
+            }
+            interrupt::irq_manager->attach(irq, handler);
+        };
+        if(xhc) {
+            start_interrupt_thread(xhc_interrupt, xhc_irq, -2);
+        }
         if(sata_controller) {
-            const auto tid_r = process::manager->create_thread(kernel_pid, fs::device_finder_main, reinterpret_cast<int64_t>(sata_controller.get()));
-            fatal_assert(tid_r, "failed to create disk finder thread");
-            const auto tid = tid_r.as_value();
-            fatal_assert(!process::manager->wakeup_thread(kernel_pid, tid, -1), "failed to wakeup disk finder thread");
-            fs_device_finder_tid = tid;
+            start_interrupt_thread(sata_interrupt, sata_irq, -1);
+        }
+        if(virtio_gpu) {
+            start_interrupt_thread(virtio_gpu_control_interrupt, virtio_gpu_control_irq, -1);
+        }
+
+        if(sata_controller) {
+            fatal_assert(!workqueue::queue_work(system_workqueue, fs::find_devices, sata_controller.get()), "failed to queue disk finder");
         }
 
         // boot aps
@@ -356,6 +428,8 @@ class Kernel {
                 logger(LogLevel::Error, "kernel: ap boot failed: %d\n", e.as_int());
             }
         }
+        // spread device interrupts over the new processors
+        irq_manager.balance();
         ap_trampoline_page.free();
 
         // initialize syscall
@@ -399,24 +473,19 @@ class Kernel {
         }
 
     loop:
-        const auto& messages = kernel_message_queue.swap();
-        if(messages.empty()) {
-            process::manager->sleep_this_thread();
+        if(const auto lost = kernel_message_queue.take_overflows(); lost != 0) {
+            logger(LogLevel::Error, "kernel: %lu messages dropped, message queue is full\n", lost);
+        }
+
+        auto       messages = std::array<Message, 16>();
+        const auto count    = kernel_message_queue.pop(messages);
+        if(count == 0) {
+            process::manager->wait_interrupt();
             goto loop;
         }
 
-        for(const auto& m : messages) {
+        for(const auto& m : std::span(messages.data(), count)) {
             switch(m.type) {
-            case MessageType::XHCIInterrupt:
-                while(xhc->has_unprocessed_event()) {
-                    if(const auto error = xhc->process_event()) {
-                        logger(LogLevel::Error, "kernel: failed to process xhc event: %d\n", error);
-                    }
-                }
-                break;
-            case MessageType::AHCIInterrupt:
-                sata_controller->on_interrupt();
-                break;
             case MessageType::VirtIOGPUNewDevice: {
                 virtio_gpu_framebuffer = virtio_gpu->create_devfs_framebuffer();
                 if(const auto e = fs::manager->create_device_file("fb-virtio0", virtio_gpu_framebuffer.get())) {
@@ -424,18 +493,6 @@ class Kernel {
                 }
                 terminal_fb_dev = "/dev/fb-virtio0";
             } break;
-            case MessageType::VirtIOGPUControl:
-                if(const auto e = virtio_gpu->process_control_queue()) {
-                    logger(LogLevel::Error, "kernel: failed to process virtio gpu event: %d\n", e.as_int());
-                }
-                break;
-            case MessageType::VirtIOGPUCursor:
-                break;
-            case MessageType::DeviceFinderDone:
-                if(const auto e = process::manager->wait_thread(kernel_pid, fs_device_finder_tid)) {
-                    logger(LogLevel::Error, "kernel: failed to finish device finder thread\n");
-                }
-                break;
             }
         }
         goto loop;
@@ -465,11 +522,30 @@ extern "C" void kernel_main(const MemoryMap& memory_map_ref, const FramebufferCo
 // interrupt/interrupt.hpp
 namespace interrupt::internal {
 extern "C" auto int_handler_lapic_timer(process::ThreadContext& context) -> void {
+    const auto stat = StatScope(Vector::LAPICTimer);
     notify_end_of_interrupt();
     process::manager->switch_thread_may_fail(context);
 }
+
+extern "C" auto int_handler_reschedule(process::ThreadContext& context) -> void {
+    const auto stat = StatScope(Vector::Reschedule);
+    notify_end_of_interrupt();
+    process::manager->reschedule(context);
+}
+
+extern "C" auto int_handler_device_not_available() -> process::ThreadContext* {
+    const auto stat = StatScope(7);
+    return process::manager->claim_fpu();
+}
 } // namespace interrupt::internal
 
+// process/process.asm
+namespace process {
+extern "C" auto release_scheduler_lock() -> void {
+    manager->finish_switch();
+}
+} // namespace process
+
 // syscall
 namespace syscall {
 extern "C" {
@@ -477,9 +553,5 @@ auto syscall_table = std::array<void*, 2>{
     (void*)syscall_printk,
     (void*)syscall_exit,
 };
-
-__attribute__((no_caller_saved_registers)) auto get_stack_ptr() -> uintptr_t {
-    return process::manager->get_this_thread()->system_stack_address;
-}
 }
 } // namespace syscall
@@ -9,6 +9,7 @@
 #include "../panic.hpp"
 #include "frame.hpp"
 #include "memory-type.hpp"
+#include "shrinker.hpp"
 
 namespace memory {
 class BitmapMemoryManager {
@@ -19,8 +20,12 @@ class BitmapMemoryManager {
     static constexpr auto bits_per_mapline = 8 * sizeof(MaplineType);
 
     std::array<MaplineType, required_frames / bits_per_mapline> allocation_map;
-    FrameID                                                     range_begin = FrameID(0);
-    FrameID                                                     range_end   = FrameID(required_frames);
+    FrameID                                                     range_begin    = FrameID(0);
+    FrameID                                                     range_end      = FrameID(required_frames);
+    size_t                                                      usable_frames  = 0;
+    size_t                                                      free_frames    = 0;
+    size_t                                                      low_watermark  = 0;
+    size_t                                                      high_watermark = 0;
 
     auto get_bit(const FrameID frame) const -> bool {
         const auto line_index = frame.get_id() / bits_per_mapline;
@@ -47,6 +52,14 @@ class BitmapMemoryManager {
     auto set_range(const FrameID begin, const FrameID end) -> void {
         range_begin = begin;
         range_end   = end;
+
+        free_frames = 0;
+        for(auto i = begin.get_id(); i <= end.get_id(); i += 1) {
+            free_frames += get_bit(FrameID(i)) ? 0 : 1;
+        }
+        usable_frames  = free_frames;
+        low_watermark  = free_frames * constants::memory_low_watermark / 100;
+        high_watermark = free_frames * constants::memory_high_watermark / 100;
     }
 
   public:
@@ -65,6 +78,7 @@ class BitmapMemoryManager {
         if(i == frames) {
             auto r = FrameID(start_frame_id);
             set_bits(r, frames, true);
+            free_frames -= frames;
             return SmartFrameID(r, frames);
         }
         start_frame_id += i + 1;
@@ -76,6 +90,7 @@ class BitmapMemoryManager {
             const auto id = FrameID(i);
             if(!get_bit(id)) {
                 set_bit(id, true);
+                free_frames -= 1;
                 return SmartSingleFrameID(id);
             }
         }
@@ -84,9 +99,19 @@ class BitmapMemoryManager {
 
     auto deallocate(const FrameID begin, const size_t frames) -> Error {
         set_bits(begin, frames, false);
+        free_frames += frames;
         return Success();
     }
 
+    auto get_usable_frames() const -> size_t {
+        return usable_frames;
+    }
+
+    // frames to reclaim to get back above the high watermark, 0 while above the low watermark
+    auto get_reclaim_target() const -> size_t {
+        return free_frames < low_watermark ? high_watermark - free_frames : 0;
+    }
+
     auto is_available(const size_t address) -> bool {
         const auto frame = address / bytes_per_frame;
         return !get_bit(FrameID(frame));
@@ -132,14 +157,35 @@ class BitmapMemoryManager {
 
 inline auto critical_allocator = (Critical<BitmapMemoryManager*>*)(nullptr);
 
+namespace internal {
+// wakes the reclaimer when free frames run below the low watermark, or when an allocation fails
+inline auto request_reclaim(const BitmapMemoryManager& allocator, const size_t failed) -> void {
+    if(reclaimer == nullptr) {
+        return;
+    }
+    if(const auto target = std::max(allocator.get_reclaim_target(), failed); target != 0) {
+        reclaimer->request(target);
+    }
+}
+} // namespace internal
+
+inline auto get_usable_frames() -> size_t {
+    auto [lock, allocator] = critical_allocator->access();
+    return allocator->get_usable_frames();
+}
+
 inline auto allocate(const size_t frames) -> Result<SmartFrameID> {
     auto [lock, allocator] = critical_allocator->access();
-    return allocator->allocate(frames);
+    auto result            = allocator->allocate(frames);
+    internal::request_reclaim(*allocator, result ? 0 : frames);
+    return result;
 }
 
 inline auto allocate_single() -> Result<SmartSingleFrameID> {
     auto [lock, allocator] = critical_allocator->access();
-    return allocator->allocate_single();
+    auto result            = allocator->allocate_single();
+    internal::request_reclaim(*allocator, result ? 0 : 1);
+    return result;
 }
 
 inline auto SmartFrameID::free() -> void {
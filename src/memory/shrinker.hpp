@@ -0,0 +1,114 @@
+#pragma once
+#include <array>
+
+#include "../process/manager.hpp"
+#include "../util/spinlock.hpp"
+
+namespace memory {
+// a cache which gives frames back under memory pressure
+class Shrinker {
+  public:
+    // frees up to frames, returns the number of frames freed
+    virtual auto shrink(size_t frames) -> size_t = 0;
+
+    virtual ~Shrinker() {}
+};
+
+// runs shrinkers on its own thread
+// the allocator only wakes it, so allocating code never reenters a cache it may be holding locks of
+class Reclaimer {
+  private:
+    // pause after a pass which freed nothing, doubled while passes keep failing
+    constexpr static auto min_backoff_ms = size_t(10);
+    constexpr static auto max_backoff_ms = size_t(1000);
+
+    spinlock::SpinLock            mutex;
+    std::array<Shrinker*, 8>      shrinkers;
+    size_t                        shrinker_count = 0;
+    std::atomic<process::Thread*> thread         = nullptr;
+    std::atomic_size_t            target         = 0;     // frames requested since the last pass
+    std::atomic_bool              busy           = false; // woken and not done, requests meanwhile only raise target
+
+    static auto reclaimer_main(const uint64_t /*id*/, const int64_t data) -> void {
+        auto& self    = *std::bit_cast<Reclaimer*>(data);
+        auto  backoff = min_backoff_ms;
+        while(true) {
+            // requests made before the thread started are served first
+            while(true) {
+                const auto frames = self.target.exchange(0);
+                if(frames == 0) {
+                    self.busy = false;
+                    // a request may have seen busy just before it was cleared
+                    if(self.target.load() == 0 || self.busy.exchange(true)) {
+                        break;
+                    }
+                    continue;
+                }
+
+                const auto freed = self.reclaim(frames);
+                if(freed != 0) {
+                    logger(LogLevel::Debug, "memory: reclaimed %lu of %lu frames\n", freed, frames);
+                    backoff = min_backoff_ms;
+                    continue;
+                }
+                // every cache is dirty or in use, rescanning on each allocation would not change that
+                process::manager->suspend_this_thread_for_ms(backoff);
+                backoff = std::min(backoff * 2, max_backoff_ms);
+            }
+            process::manager->wait_interrupt();
+        }
+    }
+
+  public:
+    auto add(Shrinker& shrinker) -> Error {
+        const auto lock = mutex_like::AutoMutex(mutex);
+        if(shrinker_count == shrinkers.size()) {
+            return Error::Code::Full;
+        }
+        shrinkers[shrinker_count] = &shrinker;
+        shrinker_count += 1;
+        return Success();
+    }
+
+    auto reclaim(const size_t frames) -> size_t {
+        auto freed = size_t(0);
+        for(auto i = size_t(0); freed < frames; i += 1) {
+            auto shrinker = (Shrinker*)(nullptr);
+            {
+                const auto lock = mutex_like::AutoMutex(mutex);
+                if(i == shrinker_count) {
+                    break;
+                }
+                shrinker = shrinkers[i];
+            }
+            freed += shrinker->shrink(frames - freed);
+        }
+        return freed;
+    }
+
+    // does not allocate nor block, requests until the next pass are merged
+    // the thread is woken only when it is not already busy
+    auto request(const size_t frames) -> void {
+        auto current = target.load();
+        while(current < frames && !target.compare_exchange_weak(current, frames)) {
+        }
+        if(busy.exchange(true)) {
+            return;
+        }
+        if(const auto t = thread.load(); t != nullptr) {
+            process::manager->notify_interrupt(t);
+        }
+    }
+
+    auto start() -> Error {
+        const auto r = process::manager->create_interrupt_thread(reclaimer_main, std::bit_cast<int64_t>(this), 0, process::any_processor, process::SchedulingPolicy::Fair);
+        if(!r) {
+            return r.as_error();
+        }
+        thread.store(r.as_value());
+        return Success();
+    }
+};
+
+inline auto reclaimer = (Reclaimer*)(nullptr);
+} // namespace memory
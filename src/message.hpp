@@ -1,15 +1,11 @@
 #pragma once
 #include <cstdint>
 
-#include "util/critical-queue.hpp"
+#include "util/mpsc-ring.hpp"
 
+// device interrupts are serviced by interrupt::ThreadedHandler
 enum class MessageType {
-    XHCIInterrupt,
-    AHCIInterrupt,
     VirtIOGPUNewDevice,
-    VirtIOGPUControl,
-    VirtIOGPUCursor,
-    DeviceFinderDone,
 };
 
 struct Message {
@@ -19,4 +15,4 @@ struct Message {
     Message(const MessageType type) : type(type) {}
 };
 
-inline auto kernel_message_queue = CriticalQueue<Message>();
+inline auto kernel_message_queue = MPSCRing<Message, 256>();
@@ -2,10 +2,12 @@
 #include <cstdint>
 
 enum MSR : uint32_t {
-    EFER  = 0xC0000080, // Extended Feature Enable Register
-    STAR  = 0xC0000081, // System Target Address Register legacy mode SYSCALL target
-    LSTAR = 0xC0000082, // long mode SYSCALL target
-    FMASK = 0xC0000084, // EFLAGS mask for syscall
+    EFER         = 0xC0000080, // Extended Feature Enable Register
+    STAR         = 0xC0000081, // System Target Address Register legacy mode SYSCALL target
+    LSTAR        = 0xC0000082, // long mode SYSCALL target
+    FMASK        = 0xC0000084, // EFLAGS mask for syscall
+    GSBase       = 0xC0000101, // base address of gs segment
+    KernelGSBase = 0xC0000102, // exchanged with GSBase by swapgs
 };
 
 union ExtendedFeatureEnableRegister {
@@ -3,57 +3,175 @@
 #include "process/manager.hpp"
 #include "util/mutex-like.hpp"
 
-class Mutex {
+// kernel event allocated by the first thread that has to sleep
+class LazyEventID {
   private:
-    std::atomic_flag flag;
-    process::EventID id = process::invalid_event;
+    std::atomic<process::EventID> id = process::invalid_event;
+
+  public:
+    auto get() -> process::EventID {
+        auto current = id.load();
+        if(current != process::invalid_event) {
+            return current;
+        }
+
+        const auto created = process::manager->create_event();
+        if(created == process::invalid_event || id.compare_exchange_strong(current, created)) {
+            return created;
+        }
+        // another thread installed its event first
+        if(const auto e = process::manager->delete_event(created)) {
+            logger(LogLevel::Error, "mutex: failed to delete event %lu(%lu)\n", created, e.as_int());
+        }
+        return current;
+    }
+
+    auto peek() const -> process::EventID {
+        return id.load();
+    }
 
     auto erase() -> void {
-        if(id != process::invalid_event) {
-            if(const auto e = process::manager->delete_event(id)) {
-                logger(LogLevel::Error, "mutex: failed to delete event %lu(%lu)\n", id, e.as_int());
+        if(const auto current = id.exchange(process::invalid_event); current != process::invalid_event) {
+            if(const auto e = process::manager->delete_event(current)) {
+                logger(LogLevel::Error, "mutex: failed to delete event %lu(%lu)\n", current, e.as_int());
             }
         }
     }
 
+    auto operator=(LazyEventID&& o) -> LazyEventID& {
+        erase();
+        id = o.id.exchange(process::invalid_event);
+        return *this;
+    }
+
+    LazyEventID(LazyEventID&& o) {
+        *this = std::move(o);
+    }
+
+    LazyEventID() = default;
+
+    ~LazyEventID() {
+        erase();
+    }
+};
+
+class Mutex {
+  private:
+    // owner thread pointer, contended_bit is set while waiters may be sleeping
+    // owner inherits the highest priority of the waiters until release
+    constexpr static auto contended_bit = uintptr_t(1);
+    // pause iterations while the owner is running on another processor
+    constexpr static auto spin_limit = size_t(1000);
+
+    std::atomic_uintptr_t                state = 0;
+    process::PriorityBoost               boost;
+    LazyEventID                          id;
+    bool                                 handoff = false; // pass ownership to the woken waiter directly
+    [[no_unique_address]] lockstat::Stat<> stat;
+
+    static auto to_owner(const uintptr_t state) -> process::Thread* {
+        return std::bit_cast<process::Thread*>(state & ~contended_bit);
+    }
+
+    auto try_aquire(const uintptr_t this_thread) -> bool {
+        auto current = state.load();
+        while(to_owner(current) == nullptr) {
+            if(state.compare_exchange_weak(current, this_thread | current)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    auto mark_contended() -> process::Thread* {
+        auto current = state.load();
+        while(to_owner(current) != nullptr && (current & contended_bit) == 0) {
+            if(state.compare_exchange_weak(current, current | contended_bit)) {
+                break;
+            }
+        }
+        return to_owner(current);
+    }
+
   public:
     auto aquire() -> void {
-        while(flag.test_and_set()) {
-            if(const auto e = process::manager->wait_event(id)) {
-                logger(LogLevel::Error, "mutex: failed to wait event %lu(%lu)\n", id, e.as_int());
+        const auto this_thread = std::bit_cast<uintptr_t>(process::manager->get_this_thread());
+        const auto wait_begin  = stat.now();
+
+        auto spins     = size_t(0);
+        auto contended = false;
+        while(!try_aquire(this_thread)) {
+            contended        = true;
+            const auto owner = to_owner(state.load());
+            if(owner != nullptr && spins < spin_limit && process::manager->is_running_on_other_processor(owner)) {
+                spins += 1;
+                __asm__("pause");
+                continue;
+            }
+
+            const auto event = id.get();
+            if(event == process::invalid_event) {
+                __asm__("pause");
+                continue;
             }
+            if(const auto e = process::manager->wait_event_and_boost(event, boost, [this]() { return mark_contended(); })) {
+                logger(LogLevel::Error, "mutex: failed to wait event %lu(%lu)\n", event, e.as_int());
+            }
+            if(std::bit_cast<uintptr_t>(to_owner(state.load())) == this_thread) {
+                // handed off
+                break;
+            }
+            spins = 0;
         }
+        stat.on_aquire(wait_begin, contended);
     }
 
     auto try_aquire() -> bool {
-        if(flag.test_and_set()) {
+        if(!try_aquire(std::bit_cast<uintptr_t>(process::manager->get_this_thread()))) {
             return false;
         }
+        stat.on_aquire(0, false);
         return true;
     }
 
     auto release() -> void {
-        flag.clear();
-        if(const auto e = process::manager->notify_event(id)) {
-            logger(LogLevel::Error, "mutex: failed to notify event %lu(%lu)\n", id, e.as_int());
+        stat.on_release();
+
+        auto expected = state.load() & ~contended_bit;
+        if(state.compare_exchange_strong(expected, 0)) {
+            return;
+        }
+
+        // contended, waiters have created the event
+        const auto event   = id.peek();
+        const auto release = [this](process::Thread* const woken, const bool more_waiters) {
+            const auto waiting = more_waiters ? contended_bit : 0;
+            if(handoff && woken != nullptr) {
+                state.store(std::bit_cast<uintptr_t>(woken) | waiting);
+            } else {
+                state.store(waiting);
+            }
+        };
+        if(const auto e = process::manager->unboost_and_notify_one(event, boost, release)) {
+            logger(LogLevel::Error, "mutex: failed to notify event %lu(%lu)\n", event, e.as_int());
         }
     }
 
     auto operator=(Mutex&& o) -> Mutex& {
-        erase();
-        id = std::exchange(o.id, process::invalid_event);
+        id      = std::move(o.id);
+        handoff = o.handoff;
+        stat    = o.stat;
         return *this;
     }
 
-    Mutex(Mutex&& o) {
+    Mutex(Mutex&& o) : stat(o.stat) {
         *this = std::move(o);
     }
 
-    Mutex() : id(process::manager->create_event()) {
+    Mutex(const char* const file = __builtin_FILE(), const uint32_t line = __builtin_LINE()) : stat(file, line) {
     }
 
-    ~Mutex() {
-        erase();
+    explicit Mutex(const bool handoff, const char* const file = __builtin_FILE(), const uint32_t line = __builtin_LINE()) : handoff(handoff), stat(file, line) {
     }
 };
 
@@ -62,32 +180,149 @@ using SmartMutex = mutex_like::AutoMutex<Mutex>;
 template <class T>
 using Critical = mutex_like::SharedValue<Mutex, T>;
 
-class Event {
+// blocking reader-writer lock
+// new readers wait while a writer is sleeping for the lock, so writers are not starved
+class SharedMutex {
   private:
-    std::atomic_flag flag;
-    process::EventID id;
+    constexpr static auto writer_bit  = uint64_t(1) << 63;
+    constexpr static auto waiting_bit = uint64_t(1) << 62; // sleepers may exist
+    constexpr static auto reader_mask = waiting_bit - 1;
 
-    auto erase() -> void {
-        if(id != process::invalid_event) {
-            if(const auto e = process::manager->delete_event(id)) {
-                logger(LogLevel::Error, "mutex: failed to delete event %lu(%lu)\n", id, e.as_int());
+    std::atomic_uint64_t state = 0;
+    LazyEventID          id;
+
+    static auto is_writable(const uint64_t state) -> bool {
+        return (state & ~waiting_bit) == 0;
+    }
+
+    static auto is_readable(const uint64_t state) -> bool {
+        if(state & writer_bit) {
+            return false;
+        }
+        return (state & waiting_bit) == 0 || (state & reader_mask) == 0;
+    }
+
+    // returns true if the caller should sleep
+    auto mark_waiting(bool (*const is_available)(uint64_t)) -> bool {
+        auto current = state.load();
+        while(!is_available(current)) {
+            if((current & waiting_bit) || state.compare_exchange_weak(current, current | waiting_bit)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    auto sleep(bool (*const is_available)(uint64_t)) -> void {
+        const auto event = id.get();
+        if(event == process::invalid_event) {
+            __asm__("pause");
+            return;
+        }
+        if(const auto e = process::manager->wait_event_if(event, [this, is_available]() { return mark_waiting(is_available); })) {
+            logger(LogLevel::Error, "mutex: failed to wait event %lu(%lu)\n", event, e.as_int());
+        }
+    }
+
+    auto wakeup() -> void {
+        const auto event = id.peek();
+        if(const auto e = process::manager->notify_event(event)) {
+            logger(LogLevel::Error, "mutex: failed to notify event %lu(%lu)\n", event, e.as_int());
+        }
+    }
+
+  public:
+    auto aquire() -> void {
+        while(!try_aquire()) {
+            sleep(is_writable);
+        }
+    }
+
+    auto try_aquire() -> bool {
+        auto current = state.load();
+        while(is_writable(current)) {
+            if(state.compare_exchange_weak(current, current | writer_bit)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    auto release() -> void {
+        if(state.exchange(0) & waiting_bit) {
+            wakeup();
+        }
+    }
+
+    auto aquire_shared() -> void {
+        while(!try_aquire_shared()) {
+            sleep(is_readable);
+        }
+    }
+
+    auto try_aquire_shared() -> bool {
+        auto current = state.load();
+        while(is_readable(current)) {
+            if(state.compare_exchange_weak(current, current + 1)) {
+                return true;
             }
         }
+        return false;
+    }
+
+    auto release_shared() -> void {
+        // the last reader wakes up the sleepers
+        auto current = state.fetch_sub(1) - 1;
+        while(current == waiting_bit) {
+            if(state.compare_exchange_weak(current, 0)) {
+                wakeup();
+                return;
+            }
+        }
+    }
+
+    auto operator=(SharedMutex&& o) -> SharedMutex& {
+        id = std::move(o.id);
+        return *this;
+    }
+
+    SharedMutex(SharedMutex&& o) {
+        *this = std::move(o);
+    }
+
+    SharedMutex() {
     }
+};
+
+template <class T>
+using SharedCritical = mutex_like::ReadWriteValue<SharedMutex, T>;
+
+class Event {
+  private:
+    std::atomic_flag flag;
+    LazyEventID      id;
 
   public:
     auto wait() -> void {
         while(!flag.test()) {
-            if(const auto e = process::manager->wait_event(id)) {
-                logger(LogLevel::Error, "mutex: failed to wait event %lu(%lu)\n", id, e.as_int());
+            const auto event = id.get();
+            if(event == process::invalid_event) {
+                __asm__("pause");
+                continue;
+            }
+            if(const auto e = process::manager->wait_event_if(event, [this]() { return !flag.test(); })) {
+                logger(LogLevel::Error, "mutex: failed to wait event %lu(%lu)\n", event, e.as_int());
             }
         }
     }
 
     auto notify() -> void {
         if(!flag.test_and_set()) {
-            if(const auto e = process::manager->notify_event(id)) {
-                logger(LogLevel::Error, "event: failed to notify event %lu(%lu)\n", id, e.as_int());
+            // nobody has slept yet if the event is not created
+            if(const auto event = id.peek(); event != process::invalid_event) {
+                if(const auto e = process::manager->notify_event(event)) {
+                    logger(LogLevel::Error, "event: failed to notify event %lu(%lu)\n", event, e.as_int());
+                }
             }
         }
     }
@@ -96,22 +331,17 @@ class Event {
         flag.clear();
     }
 
-    auto is_valid() const -> bool {
-        return id != process::invalid_event;
-    }
-
     auto test() const -> bool {
         return flag.test();
     }
 
-    auto read_id() const -> process::EventID {
-        return id;
+    // creates the kernel event
+    auto read_id() -> process::EventID {
+        return id.get();
     }
 
     auto operator=(Event&& o) -> Event& {
-        erase();
-        id   = o.id;
-        o.id = process::invalid_event;
+        id = std::move(o.id);
         return *this;
     }
 
@@ -119,9 +349,5 @@ class Event {
         *this = std::move(o);
     }
 
-    Event() : id(process::manager->create_event()) {}
-
-    ~Event() {
-        erase();
-    }
+    Event() {}
 };
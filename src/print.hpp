@@ -3,6 +3,7 @@
 #include <span>
 #include <string_view>
 
+#include "arch/amd64/rflags.hpp"
 #include "debug.hpp"
 #include "stdio.h"
 #include "util/spinlock.hpp"
@@ -13,7 +14,7 @@ struct PrintBuffer {
     std::array<char, buffer_size> buffer;
     size_t                        head = 0;
     size_t                        len  = 0;
-    spinlock::SpinLock            lock;
+    spinlock::TicketLock          lock;
 };
 
 inline auto printk_buffer = PrintBuffer();
@@ -21,7 +22,9 @@ inline auto printk_buffer = PrintBuffer();
 inline auto printk(std::span<char> buf) -> int {
     debug::println(std::string_view(buf.data(), buf.size()));
 
-    const auto lock = mutex_like::AutoMutex<spinlock::SpinLock>(printk_buffer.lock);
+    // interrupt handlers may print too
+    const auto guard = amd64::InterruptGuard();
+    const auto lock  = mutex_like::AutoMutex<spinlock::TicketLock>(printk_buffer.lock);
 
     const auto buf_len = buf.size();
 
@@ -0,0 +1,151 @@
+#pragma once
+#include "../error.hpp"
+#include "../log.hpp"
+#include "../util/spinlock.hpp"
+#include "process.hpp"
+
+namespace process {
+struct EventSlot {
+    spinlock::SpinLock lock;
+    EventWaiter*       waiters    = nullptr;
+    uint32_t           generation = 0;
+    uint32_t           next_free  = 0;
+    bool               alive      = false;
+
+    auto push(EventWaiter& waiter) -> void {
+        waiter.prev = nullptr;
+        waiter.next = waiters;
+        if(waiters != nullptr) {
+            waiters->prev = &waiter;
+        }
+        waiters = &waiter;
+    }
+
+    auto erase(EventWaiter& waiter) -> void {
+        if(waiter.prev != nullptr) {
+            waiter.prev->next = waiter.next;
+        } else {
+            waiters = waiter.next;
+        }
+        if(waiter.next != nullptr) {
+            waiter.next->prev = waiter.prev;
+        }
+        waiter.prev = nullptr;
+        waiter.next = nullptr;
+    }
+
+    // the highest priority waiter, the oldest one among the same priority
+    auto find_most_urgent() const -> EventWaiter* {
+        auto result = (EventWaiter*)(nullptr);
+        for(auto w = waiters; w != nullptr; w = w->next) {
+            if(result == nullptr || w->thread->nice <= result->thread->nice) {
+                result = w;
+            }
+        }
+        return result;
+    }
+};
+
+// slots are never freed, so a slot found by id can be locked and then checked against the generation
+class EventTable {
+  private:
+    constexpr static auto slots_per_chunk = size_t(1024);
+    constexpr static auto max_chunks      = size_t(1024);
+    constexpr static auto invalid_slot    = uint32_t(-1);
+
+    using Chunk = std::array<EventSlot, slots_per_chunk>;
+
+    std::array<std::atomic<Chunk*>, max_chunks> chunks = {};
+
+    spinlock::SpinLock mutex; // for free list
+    uint32_t           free_head  = invalid_slot;
+    uint32_t           slot_count = 0;
+
+    static auto to_slot_index(const EventID id) -> uint32_t {
+        return uint32_t(id);
+    }
+
+    static auto to_generation(const EventID id) -> uint32_t {
+        return uint32_t(id >> 32);
+    }
+
+    static auto to_event_id(const uint32_t slot_index, const uint32_t generation) -> EventID {
+        return EventID(generation) << 32 | slot_index;
+    }
+
+    auto get_slot(const uint32_t slot_index) -> EventSlot& {
+        return (*chunks[slot_index / slots_per_chunk].load(std::memory_order_acquire))[slot_index % slots_per_chunk];
+    }
+
+  public:
+    auto allocate() -> Result<EventID> {
+        const auto lock = mutex_like::AutoMutex(mutex);
+
+        if(free_head == invalid_slot) {
+            if(slot_count == slots_per_chunk * max_chunks) {
+                return Error::Code::Full;
+            }
+            if(slot_count % slots_per_chunk == 0) {
+                chunks[slot_count / slots_per_chunk].store(new Chunk, std::memory_order_release);
+            }
+            free_head = slot_count;
+            get_slot(free_head).next_free = invalid_slot;
+            slot_count += 1;
+        }
+
+        const auto slot_index = free_head;
+        auto&      slot       = get_slot(slot_index);
+        free_head             = slot.next_free;
+
+        const auto slot_lock = mutex_like::AutoMutex(slot.lock);
+        slot.alive           = true;
+        return to_event_id(slot_index, slot.generation);
+    }
+
+    auto deallocate(const EventID id) -> Error {
+        const auto slot = find(id);
+        if(slot == nullptr) {
+            return Error::Code::NoSuchEvent;
+        }
+
+        {
+            const auto slot_lock = mutex_like::AutoMutex(slot->lock);
+            if(!is_alive(*slot, id)) {
+                return Error::Code::NoSuchEvent;
+            }
+            if(slot->waiters != nullptr) {
+                logger(LogLevel::Error, "process: cannot delete event %lu because this event is still used by...\n", id);
+                for(auto w = slot->waiters; w != nullptr; w = w->next) {
+                    logger(LogLevel::Error, "  thread (%lu.%lu)\n", w->thread->process->id, w->thread->id);
+                }
+                return Error::Code::UnFinishedEvent;
+            }
+            slot->alive = false;
+            slot->generation += 1;
+        }
+
+        const auto lock = mutex_like::AutoMutex(mutex);
+        slot->next_free = free_head;
+        free_head       = to_slot_index(id);
+        return Success();
+    }
+
+    // returns nullptr if the id was never allocated
+    // the result must be checked with is_alive while holding its lock
+    auto find(const EventID id) -> EventSlot* {
+        const auto slot_index = to_slot_index(id);
+        if(slot_index / slots_per_chunk >= max_chunks) {
+            return nullptr;
+        }
+        const auto chunk = chunks[slot_index / slots_per_chunk].load(std::memory_order_acquire);
+        if(chunk == nullptr) {
+            return nullptr;
+        }
+        return &(*chunk)[slot_index % slots_per_chunk];
+    }
+
+    static auto is_alive(const EventSlot& slot, const EventID id) -> bool {
+        return slot.alive && slot.generation == to_generation(id);
+    }
+};
+} // namespace process
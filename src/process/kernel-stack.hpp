@@ -0,0 +1,88 @@
+#pragma once
+#include "../arch/amd64/rflags.hpp"
+#include "../constants.hpp"
+#include "../error.hpp"
+#include "../memory/frame.hpp"
+#include "../paging.hpp"
+#include "../smp/id.hpp"
+#include "../util/spinlock.hpp"
+
+namespace process {
+// kernel stacks live in the last 1GiB of the identity pdpt, which is shared by every pml4
+constexpr auto kernel_stack_pdpt_index    = size_t(511);
+constexpr auto kernel_stack_region_bytes  = paging::bytes_per_page * 512 * 512;
+constexpr auto kernel_stack_region_begin  = kernel_stack_pdpt_index * kernel_stack_region_bytes;
+constexpr auto kernel_stack_region_end    = kernel_stack_region_begin + kernel_stack_region_bytes;
+constexpr auto kernel_stack_pages         = constants::kernel_stack_size / paging::bytes_per_page;
+constexpr auto kernel_stack_guard_pages   = size_t(1);
+constexpr auto kernel_stack_slot_bytes    = (kernel_stack_guard_pages + kernel_stack_pages) * paging::bytes_per_page;
+constexpr auto kernel_stack_local_caching = size_t(8);
+
+static_assert(constants::supported_memory_limit <= kernel_stack_pdpt_index, "kernel stack region overlaps identity mapping");
+static_assert(constants::kernel_stack_size % paging::bytes_per_page == 0, "kernel stack size must be page aligned");
+
+// stacks are never unmapped, so freed stacks can be reused without tlb shootdown
+class KernelStackPool {
+  private:
+    spinlock::SpinLock                     mutex;
+    std::unique_ptr<paging::PageDirectory> page_directory;
+    uintptr_t                              next_slot = kernel_stack_region_begin;
+    std::vector<uintptr_t>                 free_stacks;
+    std::vector<memory::SmartFrameID>      frames;
+    std::vector<std::vector<uintptr_t>>    local_caches;
+
+    // defined in process-detail.hpp
+    auto map_new_stack() -> Result<uintptr_t>;
+
+  public:
+    // returns the top of the stack
+    auto allocate() -> Result<uintptr_t> {
+        {
+            const auto guard = amd64::InterruptGuard();
+            auto&      cache = local_caches[smp::get_processor_number()];
+            if(!cache.empty()) {
+                const auto top = cache.back();
+                cache.pop_back();
+                return top;
+            }
+        }
+        {
+            const auto lock = mutex_like::AutoMutex(mutex);
+            if(!free_stacks.empty()) {
+                const auto top = free_stacks.back();
+                free_stacks.pop_back();
+                return top;
+            }
+        }
+        return map_new_stack();
+    }
+
+    auto deallocate(const uintptr_t top) -> void {
+        {
+            const auto guard = amd64::InterruptGuard();
+            auto&      cache = local_caches[smp::get_processor_number()];
+            if(cache.size() < kernel_stack_local_caching) {
+                cache.push_back(top);
+                return;
+            }
+        }
+        const auto lock = mutex_like::AutoMutex(mutex);
+        free_stacks.push_back(top);
+    }
+
+    auto expand_locals(const size_t new_size) -> void {
+        const auto old_size = local_caches.size();
+        local_caches.resize(new_size);
+        for(auto i = old_size; i < new_size; i += 1) {
+            local_caches[i].reserve(kernel_stack_local_caching);
+        }
+    }
+
+    KernelStackPool() : page_directory(new paging::PageDirectory) {
+        auto& pdpte        = paging::get_identity_pdpt()[kernel_stack_pdpt_index];
+        pdpte.data         = &page_directory->data;
+        pdpte.bits.present = 1;
+        pdpte.bits.write   = 1;
+    }
+};
+} // namespace process
@@ -1,6 +1,8 @@
 #pragma once
+#include <set>
 #include <span>
 
+#include "../arch/amd64/tsc.hpp"
 #include "../constants.hpp"
 #include "../error.hpp"
 #include "../interrupt/vector.hpp"
@@ -9,12 +11,14 @@
 #include "../panic.hpp"
 #include "../smp/ipi.hpp"
 #include "../util/spinlock.hpp"
+#include "event-table.hpp"
+#include "kernel-stack.hpp"
 #include "process.hpp"
 
 namespace process {
 // assembly functions
 extern "C" {
-auto switch_context(const ThreadContext* next, ThreadContext* current, std::atomic_uint8_t* current_lock) -> void;
+auto switch_context(const ThreadContext* next, ThreadContext* current) -> void;
 auto restore_context(const ThreadContext* next) -> void;
 }
 
@@ -39,8 +43,36 @@ auto erase_all(T& c, const U& value) -> void {
     c.erase(it, c.end());
 }
 
+// wakeup to run latency, bucket i counts latencies in [2^(i-1), 2^i) cycles
+using LatencyHistogram  = std::array<uint64_t, 64>;
+using LatencyHistograms = std::array<LatencyHistogram, max_nice * 2 + 1>;
+
+struct ThreadStatistics {
+    ProcessID            pid;
+    ThreadID             tid;
+    Nice                 nice;
+    smp::ProcessorNumber running_on;
+    uint64_t             runtime;
+    uint64_t             voluntary_switches;
+    uint64_t             involuntary_switches;
+};
+
+constexpr static auto fair_latency_ticks     = size_t(4); // every runnable fair thread runs once in this period
+constexpr static auto fair_granularity_ticks = size_t(1);
+constexpr static auto nice_0_weight          = uint64_t(1024);
+
+constexpr static auto nice_to_weight(const Nice nice) -> uint64_t {
+    // 1.25x cpu time per nice
+    constexpr auto weights = std::array<uint64_t, max_nice * 2 + 1>{1586, 1277, 1024, 820, 655};
+    return weights[nice_to_index(nice)];
+}
+
 class ProcessorLocal {
   private:
+    uint64_t fair_weight  = 0;
+    uint64_t min_vruntime = 0;
+    Thread*  suspended    = nullptr; // fair threads kept out of fair_queue until their suspension ends
+
     static auto should_skip(const Thread* const thread, const size_t tick) -> bool {
         if(thread->suspend_from == 0) {
             return false;
@@ -50,71 +82,318 @@ class ProcessorLocal {
         return elapsed < thread->suspend_for;
     }
 
-  public:
-    Thread*                                           this_thread;
-    std::array<std::deque<Thread*>, max_nice * 2 + 1> run_queue;
-    uint8_t                                           lapic_id;
+    auto account_runtime(const uint64_t now) -> void {
+        const auto delta          = now - this_thread->accounted_at;
+        this_thread->accounted_at = now;
+        this_thread->runtime += delta;
 
-    auto update_this_thread(const size_t tick) -> void {
-        {
-            auto& nice_queue = run_queue[nice_to_index(this_thread->nice)];
-            erase_all(nice_queue, this_thread);
-            if(this_thread->running_on != smp::invalid_processor_number) {
-                nice_queue.push_back(this_thread);
+        if(this_thread == idle_thread || this_thread->policy != SchedulingPolicy::Fair) {
+            return;
+        }
+        // keep the queue ordered, reinserting the same node does not allocate in the timer interrupt
+        auto node = fair_queue.extract(this_thread);
+        this_thread->vruntime += delta * nice_0_weight / nice_to_weight(this_thread->nice);
+        if(!node.empty()) {
+            fair_queue.insert(std::move(node));
+        }
+        if(!fair_queue.empty()) {
+            min_vruntime = std::max(min_vruntime, (*fair_queue.begin())->vruntime);
+        }
+    }
+
+    auto get_fair_slice(const Thread* const thread) const -> size_t {
+        if(fair_weight == 0) {
+            return fair_latency_ticks;
+        }
+        return std::max(fair_granularity_ticks, fair_latency_ticks * nice_to_weight(thread->nice) / fair_weight);
+    }
+
+    auto can_continue(const size_t tick, const smp::ProcessorNumber processor) const -> bool {
+        if(this_thread == idle_thread || this_thread->policy != SchedulingPolicy::Fair) {
+            return false;
+        }
+        if(this_thread->running_on != processor || !this_thread->can_run_on(processor) || should_skip(this_thread, tick)) {
+            return false;
+        }
+        for(const auto& q : run_queue) {
+            for(const auto thread : q) {
+                if(!should_skip(thread, tick)) {
+                    return false;
+                }
             }
         }
+        return tick - this_thread->slice_start < get_fair_slice(this_thread);
+    }
+
+    auto pick_next_thread(const size_t tick) -> Thread* {
         for(auto nice = -max_nice; nice <= max_nice; nice += 1) {
             for(const auto thread : run_queue[nice_to_index(nice)]) {
                 if(!should_skip(thread, tick)) {
-                    thread->suspend_from = 0;
-                    this_thread          = thread;
-                    return;
+                    return thread;
                 }
             }
         }
-        fatal_error("kernel: run queue empty");
+        // suspended fair threads are not queued
+        if(!fair_queue.empty()) {
+            return *fair_queue.begin();
+        }
+        return idle_thread;
+    }
+
+    auto unlink_suspended(Thread* const thread) -> bool {
+        for(auto link = &suspended; *link != nullptr; link = &(*link)->next_suspended) {
+            if(*link == thread) {
+                *link = std::exchange(thread->next_suspended, nullptr);
+                return true;
+            }
+        }
+        return false;
     }
 
-    auto move_between_run_queue(Thread* const thread, const Nice nice) -> Error {
-        if(!is_valid_nice(nice)) {
+    auto resume_suspended(const size_t tick) -> void {
+        for(auto link = &suspended; *link != nullptr;) {
+            const auto thread = *link;
+            if(should_skip(thread, tick)) {
+                link = &thread->next_suspended;
+                continue;
+            }
+            *link                = std::exchange(thread->next_suspended, nullptr);
+            thread->suspend_from = 0;
+            enqueue(thread);
+        }
+    }
+
+  public:
+    Thread*                                           this_thread = nullptr;
+    Thread*                                           idle_thread = nullptr;
+    std::array<std::deque<Thread*>, max_nice * 2 + 1> run_queue;
+    FairQueue                                         fair_queue;
+    uint8_t                                           lapic_id;
+    LatencyHistograms                                 wakeup_latencies = {};
+
+    // whether a runnable thread has to take this processor from the current thread at once
+    auto should_preempt(const Thread* const thread, const size_t tick) const -> bool {
+        if(thread == this_thread || should_skip(thread, tick)) {
+            return false;
+        }
+        return this_thread == idle_thread || thread->get_priority().is_higher_than(this_thread->get_priority());
+    }
+
+    auto has_preempting_thread(const size_t tick) const -> bool {
+        for(const auto& q : run_queue) {
+            for(const auto thread : q) {
+                if(should_preempt(thread, tick)) {
+                    return true;
+                }
+            }
+        }
+        for(const auto thread : fair_queue) {
+            if(should_preempt(thread, tick)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    auto account_switch(Thread* const current, Thread* const next, const bool voluntary) -> void {
+        if(voluntary) {
+            current->voluntary_switches += 1;
+        } else {
+            current->involuntary_switches += 1;
+        }
+
+        // current is charged up to now by update_this_thread
+        const auto now     = current->accounted_at;
+        next->accounted_at = now;
+        if(next->woken_at != 0) {
+            const auto bucket = std::min<size_t>(std::bit_width(now - next->woken_at), LatencyHistogram().size() - 1);
+            wakeup_latencies[nice_to_index(next->nice)][bucket] += 1;
+            next->woken_at = 0;
+        }
+    }
+
+    // returns the current thread if it was evicted from this processor by its affinity
+    // the current fair thread keeps running until its slice ends unless preempt is set
+    auto update_this_thread(const size_t tick, const smp::ProcessorNumber processor, const bool preempt) -> Thread* {
+        account_runtime(amd64::read_tsc());
+        resume_suspended(tick);
+        if(!preempt && can_continue(tick, processor)) {
+            return nullptr;
+        }
+
+        auto evicted = (Thread*)(nullptr);
+        if(this_thread != idle_thread) {
+            if(this_thread->running_on == processor) {
+                if(this_thread->can_run_on(processor)) {
+                    if(this_thread->policy == SchedulingPolicy::Fixed) {
+                        erase_from_run_queue(this_thread);
+                        push_to_run_queue(this_thread);
+                    }
+                } else {
+                    dequeue(this_thread);
+                    this_thread->running_on = smp::invalid_processor_number;
+                    evicted                 = this_thread;
+                }
+            } else {
+                dequeue(this_thread);
+            }
+        }
+
+        const auto next = pick_next_thread(tick);
+        next->slice_start  = tick;
+        next->suspend_from = 0;
+        this_thread        = next;
+
+        auto& per_cpu        = smp::get_per_cpu();
+        per_cpu.this_thread  = next;
+        per_cpu.system_stack = next->system_stack_address;
+        return evicted;
+    }
+
+    auto count_threads() const -> size_t {
+        auto num = fair_queue.size();
+        for(auto& q : run_queue) {
+            num += q.size();
+        }
+        return num;
+    }
+
+    // the thread may move between the classes, fair vruntime is kept as lag while it is fixed
+    auto change_priority(Thread* const thread, const Priority priority) -> Error {
+        if(!is_valid_nice(priority.nice)) {
             return Error::Code::InvalidNice;
         }
-        if(thread->nice == nice) {
+        if(thread->policy == priority.policy && thread->nice == priority.nice) {
             return Success();
         }
 
-        erase_from_run_queue(thread);
-        thread->nice = nice;
-        push_to_run_queue(thread);
+        const auto queued = dequeue(thread);
+        thread->policy    = priority.policy;
+        thread->nice      = priority.nice;
+        if(queued) {
+            enqueue(thread);
+        }
 
         return Success();
     }
 
+    // queue a woken thread, vruntime is restored from its lag
+    // lag is never negative, so however long the thread was away it does not start behind min_vruntime
+    // a suspended fair thread waits on the suspended list instead, without weight in the queue
+    auto enqueue(Thread* const thread) -> void {
+        if(thread->policy == SchedulingPolicy::Fair) {
+            if(thread->suspend_from != 0) {
+                thread->next_suspended = std::exchange(suspended, thread);
+                return;
+            }
+            thread->vruntime += min_vruntime;
+        }
+        push_to_run_queue(thread);
+    }
+
+    // remove a sleeping or leaving thread, vruntime is kept as lag
+    // returns false if the thread was not queued
+    auto dequeue(Thread* const thread) -> bool {
+        if(unlink_suspended(thread)) {
+            return true;
+        }
+        if(!erase_from_run_queue(thread)) {
+            return false;
+        }
+        if(thread->policy == SchedulingPolicy::Fair) {
+            thread->vruntime = thread->vruntime > min_vruntime ? thread->vruntime - min_vruntime : 0;
+        }
+        return true;
+    }
+
     auto push_to_run_queue(Thread* const thread) -> void {
-        run_queue[nice_to_index(thread->nice)].push_back(thread);
+        if(thread->policy == SchedulingPolicy::Fair) {
+            fair_queue.insert(std::move(thread->fair_node));
+            fair_weight += nice_to_weight(thread->nice);
+        } else {
+            run_queue[nice_to_index(thread->nice)].push_back(thread);
+        }
     }
 
-    auto erase_from_run_queue(Thread* const thread) -> void {
-        erase_all(run_queue[nice_to_index(thread->nice)], thread);
+    auto erase_from_run_queue(Thread* const thread) -> bool {
+        if(thread->policy == SchedulingPolicy::Fair) {
+            auto node = fair_queue.extract(thread);
+            if(node.empty()) {
+                return false;
+            }
+            thread->fair_node = std::move(node);
+            fair_weight -= nice_to_weight(thread->nice);
+            return true;
+        } else {
+            auto&      queue = run_queue[nice_to_index(thread->nice)];
+            const auto size  = queue.size();
+            erase_all(queue, thread);
+            return queue.size() != size;
+        }
     }
 };
 
 class Manager {
   private:
+    // wakeups queued by queue_wakeup while the lock was busy are run by the holder before it releases the lock
+    class SchedulerLock {
+      private:
+        spinlock::TicketLock lock;
+        Manager&             manager;
+
+      public:
+        auto aquire() -> void {
+            lock.aquire();
+        }
+
+        auto try_aquire() -> bool {
+            return lock.try_aquire();
+        }
+
+        auto release() -> void {
+            while(true) {
+                manager.run_queued_wakeups();
+                lock.release();
+                // pairs with the fences in wakeup_thread_from_interrupt and reschedule
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                manager.send_reschedule_ipis();
+                // queued after the last run
+                if(manager.queued_wakeups_on.load() == 0 || !lock.try_aquire()) {
+                    return;
+                }
+            }
+        }
+
+        SchedulerLock(Manager& manager) : manager(manager) {
+        }
+    };
+
+    using AutoLock = mutex_like::AutoMutex<SchedulerLock>;
+
     uint64_t tick = 0;
 
-    spinlock::SpinLock          mutex;
+    SchedulerLock               mutex;
     IDMap<ProcessID, Process>   processes;
     std::vector<ProcessorLocal> locals;
+    KernelStackPool             stacks;
 
-    spinlock::SpinLock                                                events_mutex;
-    dense_map::DenseMap<EventID, std::optional<std::vector<Thread*>>> events;
+    // bumped on every pass through the scheduler, see rcu.hpp
+    std::array<std::atomic_uint64_t, max_processors> quiescent_counts = {};
+
+    EventTable events;
 
     const EventID thread_joined_event;
     const EventID process_joined_event;
     ProcessID     kernel_pid;
     Thread*       event_processor;
 
+    TimeoutQueue interrupt_timeouts; // linked through Thread::timeout_node, so never allocates
+
+    // per processor lock free stacks linked by Thread::next_queued_wakeup
+    std::array<std::atomic<Thread*>, max_processors> queued_wakeups      = {};
+    std::atomic<AffinityMask>                        queued_wakeups_on   = 0; // processors whose stack may not be empty
+    std::atomic<AffinityMask>                        reschedule_requests = 0; // processors whose current thread is preempted by a woken thread
+
     static auto idle_main(const uint64_t id, const int64_t data) -> void {
         while(true) {
             __asm__("hlt");
@@ -122,11 +401,18 @@ class Manager {
     }
 
     auto switch_thread(AutoLock lock) -> void {
-        auto& local = locals[smp::get_processor_number()];
+        const auto processor = smp::get_processor_number();
+        auto&      local     = locals[processor];
+        quiescent_counts[processor].fetch_add(1);
 
         const auto current_thread = local.this_thread;
-        local.update_this_thread(tick);
-        const auto next_thread = local.this_thread;
+        const auto evicted        = local.update_this_thread(tick, processor, true);
+        const auto next_thread    = local.this_thread;
+
+        if(evicted != nullptr) {
+            // context is saved before the lock is released, so it is safe to queue it now
+            fatal_assert(wakeup_thread(lock, evicted) == Error::Code::Success, "failed to move evicted thread");
+        }
 
         if(current_thread == next_thread) {
             return;
@@ -134,16 +420,25 @@ class Manager {
 
         // logger(LogLevel::Debug, "manager: context switch(%lu.%lu->%lu.%lu)", current_thread->process->id, current_thread->id, next_thread->process->id, next_thread->id);
 
-        alignas(16) const auto next_context = next_thread->context;
-        switch_context(&next_context, &current_thread->context, lock.get_raw_mutex()->get_native());
+        local.account_switch(current_thread, next_thread, true);
+
+        // switch_context releases the lock, next_thread is the current thread of this processor, so nobody else touches its context
+        lock.forget();
+        switch_context(&next_thread->context, &current_thread->context);
     }
 
-    auto switch_thread(AutoLock lock, ThreadContext& current_context, const bool continue_to_next) -> void {
-        auto& local = locals[smp::get_processor_number()];
+    auto switch_thread(AutoLock lock, ThreadContext& current_context, const bool continue_to_next, const bool preempt = false) -> void {
+        const auto processor = smp::get_processor_number();
+        auto&      local     = locals[processor];
+        quiescent_counts[processor].fetch_add(1);
 
         const auto current_thread = local.this_thread;
-        local.update_this_thread(tick);
-        const auto next_thread = local.this_thread;
+        const auto evicted        = local.update_this_thread(tick, processor, preempt);
+        const auto next_thread    = local.this_thread;
+
+        if(evicted != nullptr) {
+            fatal_assert(wakeup_thread(lock, evicted) == Error::Code::Success, "failed to move evicted thread");
+        }
 
         if(current_thread == next_thread) {
             if(continue_to_next) {
@@ -154,7 +449,9 @@ class Manager {
 
         // logger(LogLevel::Debug, "manager: context switch(%lu.%lu->%lu.%lu)", current_thread->process->id, current_thread->id, next_thread->process->id, next_thread->id);
 
-        memcpy(&current_thread->context, &current_context, sizeof(ThreadContext));
+        local.account_switch(current_thread, next_thread, false);
+
+        memcpy(&current_thread->context, &current_context, get_saved_context_size(current_context));
         if(continue_to_next) {
             trigger_timer_interrupt_to_next_processor();
             lock.forget();
@@ -190,8 +487,6 @@ class Manager {
     }
 
     auto create_thread(const AutoLock& /*lock*/, const ProcessID pid) -> Result<Thread*> {
-        const auto lock = AutoLock(mutex);
-
         if(!processes.contains(pid)) {
             return Error::Code::NoSuchProcess;
         }
@@ -204,50 +499,180 @@ class Manager {
         return thread;
     }
 
-    auto push_thread_to_events(const AutoLock& /*lock*/, const AutoLock& /*event_lock*/, const EventID event_id, Thread* const thread) -> Error {
-        if(!events.contains(event_id)) {
+    // waiter lists are modified with both the manager lock and the event lock held
+    auto push_thread_to_event(const AutoLock& /*lock*/, const EventID event_id, Thread* const thread) -> Error {
+        const auto waiter = std::find_if(thread->waiters.begin(), thread->waiters.end(), [](const EventWaiter& w) { return w.event == invalid_event; });
+        if(waiter == thread->waiters.end()) {
+            return Error::Code::TooManyEvents;
+        }
+
+        const auto slot = events.find(event_id);
+        if(slot == nullptr) {
+            return Error::Code::NoSuchEvent;
+        }
+        const auto event_lock = mutex_like::AutoMutex(slot->lock);
+        if(!EventTable::is_alive(*slot, event_id)) {
             return Error::Code::NoSuchEvent;
-        } else {
-            events[event_id]->push_back(thread);
-            thread->events.push_back(event_id);
         }
+        waiter->event = event_id;
+        slot->push(*waiter);
         return Success();
     }
 
-    auto wakeup_thread(const AutoLock& lock, Thread* const thread, const Nice nice = invalid_nice) -> Error {
-        auto& local = locals[smp::get_processor_number()];
+    auto erase_thread_from_event(const AutoLock& /*lock*/, EventWaiter& waiter) -> void {
+        const auto slot = events.find(waiter.event);
+        fatal_assert(slot != nullptr, "process::manager: unknown event_id found in thread");
+        {
+            const auto event_lock = mutex_like::AutoMutex(slot->lock);
+            slot->erase(waiter);
+        }
+        waiter.event = invalid_event;
+    }
 
-        if(thread->running_on != smp::invalid_processor_number) {
-            if(nice == invalid_nice) {
-                return Success();
+    auto get_online_affinity() const -> AffinityMask {
+        return locals.size() >= max_processors ? any_processor : (AffinityMask(1) << locals.size()) - 1;
+    }
+
+    // prefer this processor, otherwise the least loaded one allowed by the affinity
+    auto select_processor(const AutoLock& /*lock*/, const Thread* const thread) const -> smp::ProcessorNumber {
+        const auto this_processor = smp::get_processor_number();
+        if(thread->can_run_on(this_processor)) {
+            return this_processor;
+        }
+
+        auto processor = smp::invalid_processor_number;
+        auto min_num   = std::numeric_limits<size_t>::max();
+        for(auto i = size_t(0); i < locals.size(); i += 1) {
+            if(!thread->can_run_on(i)) {
+                continue;
+            }
+            if(const auto num = locals[i].count_threads(); num < min_num) {
+                processor = i;
+                min_num   = num;
+            }
+        }
+        return processor;
+    }
+
+    auto apply_boosted_priority(const AutoLock& /*lock*/, Thread* const thread) -> void {
+        const auto priority = thread->get_boosted_priority();
+        if(thread->running_on == smp::invalid_processor_number) {
+            thread->policy = priority.policy;
+            thread->nice   = priority.nice;
+            return;
+        }
+
+        auto& local = locals[thread->running_on];
+        fatal_assert(local.change_priority(thread, priority) == Error::Code::Success, "failed to apply priority boost");
+        if(local.should_preempt(thread, tick)) {
+            reschedule_requests.fetch_or(processor_to_affinity(thread->running_on));
+        }
+    }
+
+    // the boost is passed down while the owner itself sleeps for another mutex
+    auto boost_thread(const AutoLock& lock, Thread* thread, PriorityBoost* boost, const Priority priority) -> void {
+        while(thread != nullptr) {
+            if(boost->target != thread) {
+                if(boost->target != nullptr) {
+                    unboost_thread(lock, *boost);
+                }
+                boost->target   = thread;
+                boost->priority = priority;
+                boost->next     = thread->boosts;
+                thread->boosts  = boost;
+            } else if(priority.is_higher_than(boost->priority)) {
+                boost->priority = priority;
             } else {
-                return local.move_between_run_queue(thread, nice);
+                return;
             }
+            apply_boosted_priority(lock, thread);
+
+            if(thread->running_on != smp::invalid_processor_number || thread->blocked_on == nullptr) {
+                return;
+            }
+            boost  = thread->blocked_on;
+            thread = boost->target;
+        }
+    }
+
+    auto unboost_thread(const AutoLock& lock, PriorityBoost& boost) -> void {
+        const auto thread = boost.target;
+
+        auto link = &thread->boosts;
+        while(*link != &boost) {
+            link = &(*link)->next;
         }
+        *link = boost.next;
 
+        boost = PriorityBoost();
+        apply_boosted_priority(lock, thread);
+    }
+
+    auto wakeup_thread(const AutoLock& lock, Thread* const thread, const Nice nice = invalid_nice) -> Error {
+        thread->blocked_on = nullptr;
         if(nice != invalid_nice) {
             if(!is_valid_nice(nice)) {
                 return Error::Code::InvalidNice;
             }
-            thread->nice = nice;
+            thread->base_nice = nice;
+            apply_boosted_priority(lock, thread);
+        }
+
+        if(thread->running_on != smp::invalid_processor_number) {
+            return Success();
+        }
+
+        const auto processor = select_processor(lock, thread);
+        if(processor == smp::invalid_processor_number) {
+            return Error::Code::InvalidAffinity;
+        }
+        thread->running_on = processor;
+        thread->woken_at   = amd64::read_tsc();
+        auto& local        = locals[processor];
+        local.enqueue(thread);
+        if(local.should_preempt(thread, tick)) {
+            reschedule_requests.fetch_or(processor_to_affinity(processor));
         }
-        thread->running_on = smp::get_processor_number();
-        local.push_to_run_queue(thread);
         return Success();
     }
 
+    auto set_thread_affinity(AutoLock lock, Thread* const thread, const AffinityMask affinity) -> Error {
+        if((affinity & get_online_affinity()) == 0) {
+            return Error::Code::InvalidAffinity;
+        }
+        thread->affinity = affinity;
+
+        const auto processor = thread->running_on;
+        if(processor == smp::invalid_processor_number || thread->can_run_on(processor)) {
+            return Success();
+        }
+
+        auto& local = locals[processor];
+        if(thread == local.this_thread) {
+            // the running thread is evicted by the next switch on its processor
+            if(processor == smp::get_processor_number()) {
+                switch_thread(std::move(lock));
+            }
+            return Success();
+        }
+
+        local.dequeue(thread);
+        thread->running_on = smp::invalid_processor_number;
+        return wakeup_thread(lock, thread);
+    }
+
     auto sleep_thread(AutoLock lock, Thread* const thread) -> void {
         if(thread->running_on == smp::invalid_processor_number) {
             return;
         }
 
-        if(thread == locals[smp::get_processor_number()].this_thread) {
+        if(thread == get_this_thread()) {
             thread->running_on = smp::invalid_processor_number;
             switch_thread(std::move(lock));
         } else {
             auto& local        = locals[thread->running_on];
             thread->running_on = smp::invalid_processor_number;
-            local.erase_from_run_queue(thread);
+            local.dequeue(thread);
         }
     }
 
@@ -258,67 +683,132 @@ class Manager {
 
         thread->suspend_from = tick == 0 ? 1 : tick;
         thread->suspend_for  = tick == 0 ? wait_tick - 1 : wait_tick;
-        if(thread == locals[smp::get_processor_number()].this_thread) {
+        if(thread->policy == SchedulingPolicy::Fair && thread->running_on != smp::invalid_processor_number) {
+            // moved to the suspended list, so it neither holds back min_vruntime nor shrinks the slices of the others
+            auto& local = locals[thread->running_on];
+            local.dequeue(thread);
+            local.enqueue(thread);
+        }
+        if(thread == get_this_thread()) {
             switch_thread(std::move(lock));
         }
     }
 
     auto exit_thread(AutoLock lock, Thread* const thread) -> void {
-        thread->zombie = true;
-        {
-            const auto events_lock = AutoLock(events_mutex);
-            cancel_events_of_thread(lock, events_lock, thread);
+        thread->zombie     = true;
+        thread->blocked_on = nullptr;
+        cancel_events_of_thread(lock, thread);
+        if(thread->timeout_node.empty()) {
+            // exited by another thread during wait_interrupt, the node is freed along with the thread
+            const auto p         = std::find_if(interrupt_timeouts.begin(), interrupt_timeouts.end(), [thread](const auto& timeout) { return timeout.second == thread; });
+            thread->timeout_node = interrupt_timeouts.extract(p);
         }
         logger(LogLevel::Debug, "process: thread exitted(%lu.%lu)\n", thread->process->id, thread->id);
-        if(const auto e = notify_event(thread_joined_event)) {
+        if(const auto e = notify_event(lock, thread_joined_event)) {
             logger(LogLevel::Error, "process: failed to notify thread exit: %d\n", e.as_int());
         }
         sleep_thread(std::move(lock), thread);
     }
 
     auto wait_event(AutoLock lock, const EventID event_id) -> Error {
-        auto& local = locals[smp::get_processor_number()];
+        const auto this_thread = get_this_thread();
 
-        const auto events_lock = AutoLock(events_mutex);
-        if(const auto e = push_thread_to_events(lock, events_lock, event_id, local.this_thread)) {
+        if(const auto e = push_thread_to_event(lock, event_id, this_thread)) {
             return e;
         }
-        sleep_thread(std::move(lock), local.this_thread);
+        sleep_thread(std::move(lock), this_thread);
         return Success();
     }
 
-    auto unwait_event(const AutoLock& /*lock*/, const EventID event_id) -> Error {
-        auto& local = locals[smp::get_processor_number()];
-        if(!events.contains(event_id)) {
+    auto unwait_event(const AutoLock& lock, const EventID event_id) -> Error {
+        auto& waiters = get_this_thread()->waiters;
+
+        const auto waiter = std::find_if(waiters.begin(), waiters.end(), [event_id](const EventWaiter& w) { return w.event == event_id; });
+        if(waiter != waiters.end()) {
+            erase_thread_from_event(lock, *waiter);
+        }
+        return Success();
+    }
+
+    // woken threads are removed from every event they were waiting on
+    auto notify_event(const AutoLock& lock, const EventID event_id) -> Error {
+        const auto slot = events.find(event_id);
+        if(slot == nullptr) {
             return Error::Code::NoSuchEvent;
-        } else {
-            const auto thread = local.this_thread;
-            erase_all(*events[event_id], thread);
-            erase_all(thread->events, event_id);
         }
 
-        return Success();
+        auto waiter = (EventWaiter*)(nullptr);
+        {
+            const auto event_lock = mutex_like::AutoMutex(slot->lock);
+            if(!EventTable::is_alive(*slot, event_id)) {
+                return Error::Code::NoSuchEvent;
+            }
+            waiter = std::exchange(slot->waiters, nullptr);
+        }
+
+        auto error = Error();
+        while(waiter != nullptr) {
+            const auto next   = std::exchange(waiter->next, nullptr);
+            const auto thread = waiter->thread;
+            waiter->prev      = nullptr;
+            waiter->event     = invalid_event;
+            cancel_events_of_thread(lock, thread);
+            if(const auto e = wakeup_thread(lock, thread); e && !error) {
+                error = e;
+            }
+            waiter = next;
+        }
+        return error;
     }
 
-    auto cancel_events_of_thread(const AutoLock& /*lock*/, const AutoLock& /*events_lock*/, Thread* const thread) -> void {
-        for(const auto event_id : thread->events) {
-            fatal_assert(events.contains(event_id), "process::manager: unknown event_id found in thread");
-            erase_all(*events[event_id], thread);
+    auto cancel_events_of_thread(const AutoLock& lock, Thread* const thread) -> void {
+        for(auto& waiter : thread->waiters) {
+            if(waiter.event != invalid_event) {
+                erase_thread_from_event(lock, waiter);
+            }
         }
     }
 
-    auto check_message_queue_and_wakeup_kernel(const AutoLock& lock) -> void {
-        if(kernel_message_queue.empty()) {
+    // lock free, callable from interrupt handlers
+    auto queue_wakeup(Thread* const thread) -> void {
+        if(thread->wakeup_queued.exchange(true)) {
             return;
         }
-        fatal_assert(wakeup_thread(lock, event_processor) == Error::Code::Success, "failed to wakeup kernel thread");
+        const auto processor = smp::get_processor_number();
+        auto&      head      = queued_wakeups[processor];
+        auto       top       = head.load();
+        do {
+            thread->next_queued_wakeup = top;
+        } while(!head.compare_exchange_weak(top, thread));
+        queued_wakeups_on.fetch_or(processor_to_affinity(processor));
     }
 
-    static auto ms_to_tick(const size_t ms) -> size_t {
-        return ms * constants::context_switch_frequency / 1000;
+    // called by SchedulerLock with the lock held
+    auto run_queued_wakeups() -> void {
+        auto lock = AutoLock(mutex, mutex_like::locked_mutex);
+        for(auto processors = queued_wakeups_on.exchange(0); processors != 0; processors &= processors - 1) {
+            for(auto thread = queued_wakeups[std::countr_zero(processors)].exchange(nullptr); thread != nullptr;) {
+                const auto next = thread->next_queued_wakeup;
+                thread->wakeup_queued.store(false);
+                if(!thread->zombie) {
+                    fatal_assert(wakeup_thread(lock, thread) == Error::Code::Success, "failed to run queued wakeup");
+                }
+                thread = next;
+            }
+        }
+        lock.forget();
     }
 
-    static auto send_timer_ipi(const uint8_t lapic_id) -> void {
+    auto wakeup_timed_out_threads(const AutoLock& lock) -> void {
+        while(!interrupt_timeouts.empty() && interrupt_timeouts.begin()->first <= tick) {
+            auto       node      = interrupt_timeouts.extract(interrupt_timeouts.begin());
+            const auto thread    = node.value().second;
+            thread->timeout_node = std::move(node);
+            fatal_assert(wakeup_thread(lock, thread) == Error::Code::Success, "failed to wakeup interrupt thread");
+        }
+    }
+
+    static auto send_ipi(const uint8_t lapic_id, const interrupt::Vector vector) -> void {
         volatile auto& lapic_registers = lapic::get_registers();
 
         auto command_low  = smp::InterruptCommandLow{.data = lapic_registers.interrupt_command_0 & 0xFF'F0'00'00u};
@@ -327,7 +817,7 @@ class Manager {
         // clear apic error
         lapic_registers.error_status = 0;
         // create command
-        command_low.bits.vector                = interrupt::Vector::LAPICTimer;
+        command_low.bits.vector                = vector;
         command_low.bits.delivery_mode         = smp::DeliveryMode::Fixed;
         command_low.bits.destination_mode      = smp::DestinationMode::Physical;
         command_low.bits.level                 = smp::Level::Assert;
@@ -343,12 +833,30 @@ class Manager {
         }
     }
 
+    // called after the lock is released
+    auto send_reschedule_ipis() -> void {
+        auto requests = reschedule_requests.exchange(0);
+        if(requests == 0) {
+            return;
+        }
+        const auto guard = amd64::InterruptGuard(); // the timer chain writes the command registers too
+        for(; requests != 0; requests &= requests - 1) {
+            send_ipi(smp::per_cpus[std::countr_zero(requests)].lapic_id, interrupt::Vector::Reschedule);
+        }
+    }
+
     auto trigger_timer_interrupt_to_next_processor() -> void {
         const auto next_lapic_id = locals[smp::get_processor_number() + 1].lapic_id;
-        send_timer_ipi(next_lapic_id);
+        send_ipi(next_lapic_id, interrupt::Vector::LAPICTimer);
     }
 
   public:
+    constexpr static auto no_deadline = uint64_t(-1);
+
+    static auto ms_to_tick(const size_t ms) -> size_t {
+        return ms * constants::context_switch_frequency / 1000;
+    }
+
     auto create_process() -> ProcessID {
         const auto lock = AutoLock(mutex);
 
@@ -371,19 +879,79 @@ class Manager {
         }
     }
 
-    auto create_thread(const ProcessID pid, ThreadEntry* const func, const int64_t data) -> Result<ThreadID> {
+    auto create_thread(const ProcessID pid, ThreadEntry* const func, const int64_t data, const AffinityMask affinity = any_processor) -> Result<ThreadID> {
+        // may allocate frames, so do not hold the lock
+        const auto stack_r = stacks.allocate();
+        if(!stack_r) {
+            return stack_r.as_error();
+        }
+        const auto stack = stack_r.as_value();
+
         const auto lock = AutoLock(mutex);
 
+        if((affinity & get_online_affinity()) == 0) {
+            stacks.deallocate(stack);
+            return Error::Code::InvalidAffinity;
+        }
+
         if(const auto r = create_thread(lock, pid); !r) {
+            stacks.deallocate(stack);
             return r.as_error();
         } else {
             const auto thread = r.as_value();
-            thread->init_context(func, data);
+            thread->affinity  = affinity;
+            thread->init_context(func, data, stack);
             logger(LogLevel::Debug, "process: thread created with context(%lu.%lu)\n", pid, thread->id);
             return thread->id;
         }
     }
 
+    // kernel thread woken by notify_interrupt
+    auto create_interrupt_thread(ThreadEntry* const func, const int64_t data, const Nice nice, const AffinityMask affinity, const SchedulingPolicy policy = SchedulingPolicy::Fixed) -> Result<Thread*> {
+        const auto tid_r = create_thread(kernel_pid, func, data, affinity);
+        if(!tid_r) {
+            return tid_r.as_error();
+        }
+
+        const auto lock     = AutoLock(mutex);
+        const auto thread_r = find_alive_thread(lock, kernel_pid, tid_r.as_value());
+        if(!thread_r) {
+            return thread_r.as_error();
+        }
+        const auto thread   = thread_r.as_value();
+        thread->base_policy = policy;
+        if(const auto e = wakeup_thread(lock, thread, nice)) {
+            return e;
+        }
+        return thread;
+    }
+
+    // sleeps until notify_interrupt is called for this thread or the tick reaches deadline
+    // returns false on timeout
+    auto wait_interrupt(const uint64_t deadline = no_deadline) -> bool {
+        const auto this_thread = get_this_thread();
+        while(true) {
+            auto lock = AutoLock(mutex);
+            if(deadline != no_deadline) {
+                if(auto node = interrupt_timeouts.extract({deadline, this_thread}); !node.empty()) {
+                    this_thread->timeout_node = std::move(node);
+                }
+            }
+            if(this_thread->interrupt_pending.exchange(false)) {
+                return true;
+            }
+            if(tick >= deadline) {
+                return false;
+            }
+            if(deadline != no_deadline) {
+                auto& node   = this_thread->timeout_node;
+                node.value() = {deadline, this_thread};
+                interrupt_timeouts.insert(std::move(node));
+            }
+            sleep_thread(std::move(lock), this_thread);
+        }
+    }
+
     auto wakeup_thread(const ProcessID pid, const ThreadID tid, const Nice nice = invalid_nice) -> Error {
         const auto lock = AutoLock(mutex);
 
@@ -393,7 +961,23 @@ class Manager {
         }
         const auto thread = find_thread_result.as_value();
 
-        return wakeup_thread(lock, thread);
+        return wakeup_thread(lock, thread, nice);
+    }
+
+    auto set_thread_affinity(const ProcessID pid, const ThreadID tid, const AffinityMask affinity) -> Error {
+        auto lock = AutoLock(mutex);
+
+        const auto find_thread_result = find_alive_thread(lock, pid, tid);
+        if(!find_thread_result) {
+            return find_thread_result.as_error();
+        }
+
+        return set_thread_affinity(std::move(lock), find_thread_result.as_value(), affinity);
+    }
+
+    auto set_this_thread_affinity(const AffinityMask affinity) -> Error {
+        auto lock = AutoLock(mutex);
+        return set_thread_affinity(std::move(lock), get_this_thread(), affinity);
     }
 
     auto sleep_thread(const ProcessID pid, const ThreadID tid) -> Error {
@@ -409,10 +993,8 @@ class Manager {
     }
 
     auto sleep_this_thread() -> void {
-        auto  lock  = AutoLock(mutex);
-        auto& local = locals[smp::get_processor_number()];
-
-        sleep_thread(std::move(lock), local.this_thread);
+        auto lock = AutoLock(mutex);
+        sleep_thread(std::move(lock), get_this_thread());
     }
 
     auto suspend_thread_for_ms(const ProcessID pid, const ThreadID tid, const size_t ms) -> Error {
@@ -429,7 +1011,7 @@ class Manager {
     }
 
     auto suspend_this_thread_for_ms(const size_t ms) -> void {
-        suspend_thread_for_tick(AutoLock(mutex), locals[smp::get_processor_number()].this_thread, ms_to_tick(ms));
+        suspend_thread_for_tick(AutoLock(mutex), get_this_thread(), ms_to_tick(ms));
     }
 
     auto exit_thread(const ProcessID pid, const ThreadID tid) -> Error {
@@ -446,8 +1028,7 @@ class Manager {
     }
 
     auto exit_this_thread() -> void {
-        auto& local = locals[smp::get_processor_number()];
-        exit_thread(AutoLock(mutex), local.this_thread);
+        exit_thread(AutoLock(mutex), get_this_thread());
     }
 
     auto wait_thread(const ProcessID pid, const ThreadID tid) -> Error {
@@ -467,6 +1048,9 @@ class Manager {
             goto loop;
         }
 
+        if(thread->stack_top != 0) {
+            stacks.deallocate(thread->stack_top);
+        }
         const auto process = thread->process;
         process->threads[thread->id].reset();
         return Success();
@@ -493,28 +1077,16 @@ class Manager {
     }
 
     auto create_event() -> EventID {
-        const auto events_lock = AutoLock(events_mutex);
-
-        const auto event_id = events.find_empty_slot();
-        events[event_id].emplace();
-        return event_id;
+        const auto event_id_r = events.allocate();
+        if(!event_id_r) {
+            logger(LogLevel::Error, "process: failed to create event: %d\n", event_id_r.as_error().as_int());
+            return invalid_event;
+        }
+        return event_id_r.as_value();
     }
 
     auto delete_event(const EventID event_id) -> Error {
-        const auto events_lock = AutoLock(events_mutex);
-
-        if(!events.contains(event_id)) {
-            return Error::Code::NoSuchEvent;
-        }
-        if(!events[event_id]->empty()) {
-            logger(LogLevel::Error, "process: cannot delete event %u because this event is still used by...\n", event_id);
-            for(auto t : *events[event_id]) {
-                logger(LogLevel::Error, "  thread (%u.%u)\n", t->process->id, t->id);
-            }
-            return Error::Code::UnFinishedEvent;
-        }
-        events[event_id].reset();
-        return Success();
+        return events.deallocate(event_id);
     }
 
     auto wait_event(const EventID event_id) -> Error {
@@ -522,16 +1094,16 @@ class Manager {
     }
 
     auto wait_events(const std::span<EventID> event_ids) -> Error {
-        auto  lock  = AutoLock(mutex);
-        auto& local = locals[smp::get_processor_number()];
+        auto lock = AutoLock(mutex);
+        const auto this_thread = get_this_thread();
 
-        const auto events_lock = AutoLock(events_mutex);
         for(const auto event_id : event_ids) {
-            if(const auto e = push_thread_to_events(lock, events_lock, event_id, local.this_thread)) {
+            if(const auto e = push_thread_to_event(lock, event_id, this_thread)) {
+                cancel_events_of_thread(lock, this_thread);
                 return e;
             }
         }
-        sleep_thread(std::move(lock), local.this_thread);
+        sleep_thread(std::move(lock), this_thread);
         return Success();
     }
 
@@ -551,127 +1123,283 @@ class Manager {
     }
 
     auto notify_event(const EventID event_id) -> Error {
+        // skip the manager lock when nobody is waiting
+        {
+            const auto slot = events.find(event_id);
+            if(slot == nullptr) {
+                return Error::Code::NoSuchEvent;
+            }
+            const auto event_lock = mutex_like::AutoMutex(slot->lock);
+            if(!EventTable::is_alive(*slot, event_id)) {
+                return Error::Code::NoSuchEvent;
+            }
+            if(slot->waiters == nullptr) {
+                return Success();
+            }
+        }
+
+        const auto lock = AutoLock(mutex);
+        return notify_event(lock, event_id);
+    }
+
+    // links this thread to event_id first and then sleeps only if check() still returns true
+    // a notify racing with check() therefore cannot be lost
+    // check runs under the manager lock
+    template <class F>
+    auto wait_event_if(const EventID event_id, F check) -> Error {
+        auto       lock        = AutoLock(mutex);
+        const auto this_thread = get_this_thread();
+
+        if(const auto e = push_thread_to_event(lock, event_id, this_thread)) {
+            return e;
+        }
+        if(!check()) {
+            cancel_events_of_thread(lock, this_thread);
+            return Success();
+        }
+        sleep_thread(std::move(lock), this_thread);
+        return Success();
+    }
+
+    // same as wait_event_if, but get_owner() returns the thread to lend this thread's priority to
+    // returns without sleeping if get_owner() returns nullptr
+    template <class F>
+    auto wait_event_and_boost(const EventID event_id, PriorityBoost& boost, F get_owner) -> Error {
+        auto       lock        = AutoLock(mutex);
+        const auto this_thread = get_this_thread();
+
+        if(const auto e = push_thread_to_event(lock, event_id, this_thread)) {
+            return e;
+        }
+        const auto owner = get_owner();
+        if(owner == nullptr) {
+            cancel_events_of_thread(lock, this_thread);
+            return Success();
+        }
+        boost_thread(lock, owner, &boost, this_thread->get_priority());
+        this_thread->blocked_on = &boost;
+        sleep_thread(std::move(lock), this_thread);
+        return Success();
+    }
+
+    // drops the priority lent through boost and wakes up the most urgent waiter of event_id
+    // release(woken, more_waiters) is called under the manager lock, woken is nullptr if there is no waiter
+    template <class F>
+    auto unboost_and_notify_one(const EventID event_id, PriorityBoost& boost, F release) -> Error {
         const auto lock = AutoLock(mutex);
 
-        auto to_wakeup = std::vector<Thread*>();
-        {
-            const auto events_lock = AutoLock(events_mutex);
+        if(boost.target != nullptr) {
+            unboost_thread(lock, boost);
+        }
+
+        const auto slot = events.find(event_id);
+        if(slot == nullptr) {
+            release(nullptr, false);
+            return Error::Code::NoSuchEvent;
+        }
 
-            if(!events.contains(event_id)) {
+        auto waiter = (EventWaiter*)(nullptr);
+        {
+            const auto event_lock = mutex_like::AutoMutex(slot->lock);
+            if(!EventTable::is_alive(*slot, event_id)) {
+                release(nullptr, false);
                 return Error::Code::NoSuchEvent;
-            } else {
-                std::swap(*events[event_id], to_wakeup);
             }
+            waiter = slot->find_most_urgent();
+            if(waiter != nullptr) {
+                slot->erase(*waiter);
+            }
+            release(waiter != nullptr ? waiter->thread : nullptr, slot->waiters != nullptr);
+        }
+        if(waiter == nullptr) {
+            return Success();
         }
 
-        for(const auto t : to_wakeup) {
-            erase_all(t->events, event_id);
-            if(const auto e = wakeup_thread(lock, t)) {
-                return e;
+        const auto thread = waiter->thread;
+        waiter->event     = invalid_event;
+        cancel_events_of_thread(lock, thread);
+        return wakeup_thread(lock, thread);
+    }
+
+    // racy hint for adaptive spinning
+    // thread may already be freed, compare the pointer only and never dereference it
+    auto is_running_on_other_processor(const Thread* const thread) const -> bool {
+        const auto self = smp::get_processor_number();
+        for(auto i = smp::ProcessorNumber(0); i < locals.size(); i += 1) {
+            if(i != self && locals[i].this_thread == thread) {
+                return true;
             }
         }
-        return Success();
+        return false;
     }
 
     auto get_this_thread() -> Thread* {
-        auto& local = locals[smp::get_processor_number()];
-        return local.this_thread;
+        return smp::get_per_cpu().this_thread;
+    }
+
+    auto get_thread_statistics() -> std::vector<ThreadStatistics> {
+        const auto lock = AutoLock(mutex);
+
+        auto result = std::vector<ThreadStatistics>();
+        for(auto pid = ProcessID(0); pid < processes.get_slot_count(); pid += 1) {
+            if(!processes.contains(pid)) {
+                continue;
+            }
+            const auto& threads = processes[pid]->threads;
+            for(auto tid = ThreadID(0); tid < threads.get_slot_count(); tid += 1) {
+                if(!threads.contains(tid)) {
+                    continue;
+                }
+                const auto& thread = *threads[tid];
+                result.push_back(ThreadStatistics{
+                    .pid                  = pid,
+                    .tid                  = tid,
+                    .nice                 = thread.nice,
+                    .running_on           = thread.running_on,
+                    .runtime              = thread.runtime,
+                    .voluntary_switches   = thread.voluntary_switches,
+                    .involuntary_switches = thread.involuntary_switches,
+                });
+            }
+        }
+        return result;
+    }
+
+    auto get_wakeup_latencies() -> std::vector<LatencyHistograms> {
+        const auto lock = AutoLock(mutex);
+
+        auto result = std::vector<LatencyHistograms>();
+        for(const auto& local : locals) {
+            result.push_back(local.wakeup_latencies);
+        }
+        return result;
+    }
+
+    auto get_tick() const -> uint64_t {
+        return tick;
+    }
+
+    auto get_processor_count() const -> size_t {
+        return locals.size();
+    }
+
+    auto get_quiescent_count(const smp::ProcessorNumber processor) const -> uint64_t {
+        return quiescent_counts[processor].load();
     }
 
     // for kernel processes
     auto expand_locals(const size_t new_size) -> void {
+        fatal_assert(new_size <= max_processors, "process::manager: too many processors for affinity mask");
+        const auto old_size = locals.size();
         locals.resize(new_size);
+        stacks.expand_locals(new_size);
+        for(auto i = old_size; i < new_size; i += 1) {
+            const auto stack_r = stacks.allocate();
+            fatal_assert(stack_r, "process::manager: failed to allocate switch stack");
+            smp::per_cpus[i].switch_stack = stack_r.as_value();
+        }
     }
 
     auto capture_context() -> void {
-        auto& local    = locals[smp::get_processor_number()];
-        local.lapic_id = lapic::read_lapic_id();
+        const auto processor = smp::get_processor_number();
+        auto&      local     = locals[processor];
+        local.lapic_id       = lapic::read_lapic_id();
+
+        const auto idle_stack_r = stacks.allocate();
+        fatal_assert(idle_stack_r, "failed to allocate idle thread stack");
+
+        const auto lock = AutoLock(mutex);
 
         // capture this context
         {
-            const auto tid_result = create_thread(kernel_pid);
-            fatal_assert(tid_result, "failed to create kernel thread");
-            const auto tid = tid_result.as_value();
-            fatal_assert(wakeup_thread(kernel_pid, tid, -max_nice) == Error::Code::Success, "failed to wakeup kernel thread");
-            {
-                const auto lock               = AutoLock(mutex);
-                const auto find_thread_result = find_alive_thread(lock, kernel_pid, tid);
-                fatal_assert(find_thread_result, "missing kernel thread");
-                const auto thread = find_thread_result.as_value();
-                thread->movable   = false;
-                local.this_thread = thread;
-            }
+            const auto thread_r = create_thread(lock, kernel_pid);
+            fatal_assert(thread_r, "failed to create kernel thread");
+            const auto thread        = thread_r.as_value();
+            thread->affinity         = processor_to_affinity(processor);
+            thread->base_policy      = SchedulingPolicy::Fixed;
+            thread->context.fpu_used = 1; // fpu is already live in this context
+            thread->accounted_at     = amd64::read_tsc();
+            fatal_assert(wakeup_thread(lock, thread, -max_nice) == Error::Code::Success, "failed to wakeup kernel thread");
+            local.this_thread              = thread;
+            smp::get_per_cpu().this_thread = thread;
         }
 
-        // create idle thread
+        // create idle thread, which runs only when the run queues are empty
         {
-            const auto tid_result = create_thread(kernel_pid, idle_main, 0);
-            fatal_assert(tid_result, "failed to create idle thread");
-            const auto tid = tid_result.as_value();
-            fatal_assert(wakeup_thread(kernel_pid, tid, max_nice) == Error::Code::Success, "failed to wakeup idle thread");
-            {
-                const auto lock               = AutoLock(mutex);
-                const auto find_thread_result = find_alive_thread(lock, kernel_pid, tid);
-                fatal_assert(find_thread_result, "missing idle thread");
-                const auto thread = find_thread_result.as_value();
-                thread->movable   = false;
-            }
+            const auto thread_r = create_thread(lock, kernel_pid);
+            fatal_assert(thread_r, "failed to create idle thread");
+            const auto thread   = thread_r.as_value();
+            thread->affinity    = processor_to_affinity(processor);
+            thread->policy      = SchedulingPolicy::Fixed;
+            thread->base_policy = SchedulingPolicy::Fixed;
+            thread->running_on  = processor;
+            thread->init_context(idle_main, 0, idle_stack_r.as_value());
+            local.idle_thread = thread;
         }
     }
     // ~for kernel processes
 
     // for interrupt handlers
+    auto claim_fpu() -> ThreadContext* {
+        auto& context    = get_this_thread()->context;
+        context.fpu_used = 1;
+        return &context;
+    }
+
     auto migrate_threads(const AutoLock& /*lock*/) -> void {
         auto local_thread_num = std::vector<size_t>(locals.size());
         auto total_threads    = size_t(0);
 
         for(auto i = size_t(0); i < locals.size(); i += 1) {
-            auto& local = locals[i];
-            for(auto& q : local.run_queue) {
-                local_thread_num[i] += q.size();
-            }
+            local_thread_num[i] = locals[i].count_threads();
             total_threads += local_thread_num[i];
         }
-        const auto average = total_threads / locals.size();
-        const auto mod     = total_threads - average * locals.size();
-        auto       thread  = (Thread*)(nullptr);
-    loop:
-        auto exit = true;
-        for(auto i = size_t(0); i < locals.size(); i += 1) {
-            const auto threshold = i < mod ? average + 1 : average;
-            auto&      local     = locals[i];
-            if(thread == nullptr) {
-                if(local_thread_num[i] < threshold) {
-                    continue;
+        const auto average   = total_threads / locals.size();
+        const auto mod       = total_threads - average * locals.size();
+        const auto threshold = [average, mod](const size_t i) -> size_t { return i < mod ? average + 1 : average; };
+
+        const auto find_destination = [&](const Thread* const thread) -> smp::ProcessorNumber {
+            for(auto i = size_t(0); i < locals.size(); i += 1) {
+                if(local_thread_num[i] < threshold(i) && thread->can_run_on(i)) {
+                    return i;
                 }
-                for(auto q = local.run_queue.rbegin(); q != local.run_queue.rend(); q += 1) {
-                    for(const auto t : *q) {
-                        if(!t->movable || t == local.this_thread) {
+            }
+            return smp::invalid_processor_number;
+        };
+
+        for(auto i = size_t(0); i < locals.size(); i += 1) {
+            auto& local = locals[i];
+            while(local_thread_num[i] > threshold(i)) {
+                auto thread      = (Thread*)(nullptr);
+                auto destination = smp::invalid_processor_number;
+
+                // prefer low priority threads
+                const auto find_candidate = [&](auto begin, const auto end) -> void {
+                    for(; begin != end && thread == nullptr; begin = std::next(begin)) {
+                        const auto t = *begin;
+                        if(t == local.this_thread) {
                             continue;
                         }
-                        thread = t;
-                        local.erase_from_run_queue(t);
-                        local_thread_num[i] -= 1;
-                        exit = false;
-                        break;
-                    }
-                    if(thread != nullptr) {
-                        break;
+                        if(destination = find_destination(t); destination != smp::invalid_processor_number) {
+                            thread = t;
+                        }
                     }
+                };
+                find_candidate(local.fair_queue.rbegin(), local.fair_queue.rend());
+                for(auto q = local.run_queue.rbegin(); q != local.run_queue.rend(); q += 1) {
+                    find_candidate(q->begin(), q->end());
                 }
-            } else {
-                if(local_thread_num[i] >= threshold) {
-                    continue;
+                if(thread == nullptr) {
+                    break;
                 }
-                thread->running_on = i;
-                local.push_to_run_queue(thread);
-                thread = nullptr;
-                local_thread_num[i] += 1;
+
+                local.dequeue(thread);
+                local_thread_num[i] -= 1;
+                thread->running_on = destination;
+                locals[destination].enqueue(thread);
+                local_thread_num[destination] += 1;
             }
         }
-        if(!exit) {
-            goto loop;
-        }
     }
 
     auto switch_thread_may_fail(ThreadContext& current_context) -> void {
@@ -686,7 +1414,7 @@ class Manager {
         auto lock = AutoLock(mutex, mutex_like::locked_mutex);
 
         if(lapic_id == smp::first_lapic_id) {
-            check_message_queue_and_wakeup_kernel(lock);
+            wakeup_timed_out_threads(lock);
             if(tick % 500 == 0) {
                 migrate_threads(lock);
             }
@@ -695,14 +1423,49 @@ class Manager {
         switch_thread(std::move(lock), current_context, continue_to_next);
     }
 
+    // never blocks, if the lock is busy its holder runs the wakeup before releasing it
+    auto wakeup_thread_from_interrupt(Thread* const thread) -> void {
+        queue_wakeup(thread);
+        // pairs with the fence in SchedulerLock::release
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(mutex.try_aquire()) {
+            mutex.release();
+        }
+    }
+
+    // the kernel thread waits messages with wait_interrupt
     auto post_kernel_message(Message message) -> void {
-        kernel_message_queue.push(message);
+        kernel_message_queue.push(message); // overflows are reported by the consumer
+        notify_interrupt(event_processor);
+    }
+
+    auto notify_interrupt(Thread* const thread) -> void {
+        thread->interrupt_pending.store(true);
+        wakeup_thread_from_interrupt(thread);
+    }
 
+    // for the reschedule ipi, switches to a woken thread which outranks the current one
+    auto reschedule(ThreadContext& current_context) -> void {
+        const auto processor = smp::get_processor_number();
+        const auto self      = processor_to_affinity(processor);
+        // if the lock is busy, its holder sends the ipi again after releasing it
+        reschedule_requests.fetch_or(self);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
         if(!mutex.try_aquire()) {
             return;
         }
+        reschedule_requests.fetch_and(~self);
+
         auto lock = AutoLock(mutex, mutex_like::locked_mutex);
-        fatal_assert(wakeup_thread(lock, event_processor) == Error::Code::Success, "failed to wakeup kernel thread");
+        if(!locals[processor].has_preempting_thread(tick)) {
+            return;
+        }
+        switch_thread(std::move(lock), current_context, false, true);
+    }
+
+    // for switch_context, releases the lock taken by the thread switched out
+    auto finish_switch() -> void {
+        mutex.release();
     }
 
     auto post_kernel_message_with_cli(Message message) -> void {
@@ -712,9 +1475,10 @@ class Manager {
     }
     // ~for interrupt handlers
 
-    Manager() : thread_joined_event(create_event()),
+    Manager() : mutex(*this),
+                thread_joined_event(create_event()),
                 process_joined_event(create_event()) {
-        locals.resize(1);
+        expand_locals(1);
         auto& local = locals[smp::get_processor_number()];
         kernel_pid  = create_process();
         capture_context();
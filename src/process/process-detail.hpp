@@ -1,5 +1,7 @@
 #pragma once
+#include "../memory/allocator.hpp"
 #include "../mutex.hpp"
+#include "kernel-stack.hpp"
 #include "process.hpp"
 
 namespace process {
@@ -23,4 +25,35 @@ inline Process::Process(const uint64_t id) : id(id) {
     pml4e.bits.write   = 1;
     pml4e.bits.user    = 1;
 }
+
+inline auto KernelStackPool::map_new_stack() -> Result<uintptr_t> {
+    auto frames_r = memory::allocate(kernel_stack_pages);
+    if(!frames_r) {
+        return frames_r.as_error();
+    }
+    auto& stack_frames = frames_r.as_value();
+
+    const auto lock = mutex_like::AutoMutex(mutex);
+    if(next_slot + kernel_stack_slot_bytes > kernel_stack_region_end) {
+        return Error::Code::NoEnoughMemory;
+    }
+
+    // leave guard pages unmapped
+    const auto bottom = next_slot + kernel_stack_guard_pages * paging::bytes_per_page;
+    next_slot += kernel_stack_slot_bytes;
+
+    const auto physical = std::bit_cast<uintptr_t>(stack_frames->get_frame());
+    for(auto i = size_t(0); i < kernel_stack_pages; i += 1) {
+        const auto [pti, pdi, pdpti, pml4i] = paging::split_addr_for_page_table(bottom + i * paging::bytes_per_page);
+
+        auto [pde, pt]   = (*page_directory)[pdi];
+        auto& pte        = pt[pti];
+        pte.data         = physical + i * paging::bytes_per_page;
+        pte.bits.present = 1;
+        pte.bits.write   = 1;
+    }
+    frames.emplace_back(std::move(stack_frames));
+
+    return bottom + constants::kernel_stack_size;
+}
 } // namespace process
@@ -1,7 +1,10 @@
 bits 64
 section .text
 
-; void switch_context(const ThreadContext* next, ThreadContext* current, std::atomic_uint8_t* current_lock)
+extern release_scheduler_lock
+
+; void switch_context(const ThreadContext* next, ThreadContext* current)
+; called with the scheduler lock held, releases it after current is saved
 global switch_context
 switch_context:
     ; save context
@@ -31,17 +34,28 @@ switch_context:
     mov [rsi + 0x08], rax  ; RIP
     pushfq
     pop qword [rsi + 0x10] ; RFLAGS
+    cli                    ; the switch stack below must not be preempted
 
     mov [rsi + 0x20], cs
     mov [rsi + 0x28], ss
     mov [rsi + 0x30], fs
     mov [rsi + 0x38], gs
 
+    ; threads which never touched fpu have nothing to save
+    cmp qword [rsi + 0x18], 0
+    je .fpu_saved
     fxsave [rsi + 0xc0]
+.fpu_saved:
 
-    ; unlock process manager
-    xor eax, eax
-    xchg al, byte [rdx]
+    ; current may be resumed on another processor as soon as the lock is released,
+    ; so leave its stack before unlocking
+    mov rsp, [gs:16]       ; PerCPU::switch_stack
+    clts                   ; the releaser may use sse, restore_context sets CR0.TS again
+    push rdi
+    sub rsp, 8
+    call release_scheduler_lock
+    add rsp, 8
+    pop rdi
     ; fall through to restore_context
 
 ; void restore_context(const ThreadContext* next)
@@ -54,13 +68,26 @@ restore_context:
     push qword [rdi + 0x20] ; CS
     push qword [rdi + 0x08] ; RIP
 
-    ; restore context
+    ; restore fpu state, or set CR0.TS to trap the first use of it
+    mov rax, cr0
+    cmp qword [rdi + 0x18], 0
+    je .fpu_lazy
+    clts
     fxrstor [rdi + 0xc0]
+    jmp .fpu_restored
+.fpu_lazy:
+    test rax, 0x08
+    jnz .fpu_restored
+    or rax, 0x08
+    mov cr0, rax
+.fpu_restored:
+
+    ; restore context
 
     mov rax, [rdi + 0x00]
     mov cr3, rax
     mov fs, [rdi + 0x30]
-    mov gs, [rdi + 0x38]
+    ; gs is not reloaded, it would clear the per-cpu base
 
     mov rax, [rdi + 0x40]
     mov rbx, [rdi + 0x48]
@@ -79,4 +106,9 @@ restore_context:
 
     mov rdi, [rdi + 0x60]
 
+    ; swap to the user gs base when returning to ring 3, flags are restored by iretq
+    test qword [rsp + 8], 3 ; CS
+    jz .kernel
+    swapgs
+.kernel:
     iretq
@@ -1,5 +1,6 @@
 #pragma once
 #include <deque>
+#include <set>
 #include <vector>
 
 #include "../arch/amd64/control-registers.hpp"
@@ -13,29 +14,88 @@
 
 namespace process {
 struct alignas(16) ThreadContext {
-    uint64_t                 cr3, rip, rflags, reserved1;            // offset 0x00
+    uint64_t                 cr3, rip, rflags, fpu_used;             // offset 0x00
     uint64_t                 cs, ss, fs, gs;                         // offset 0x20
     uint64_t                 rax, rbx, rcx, rdx, rdi, rsi, rsp, rbp; // offset 0x40
     uint64_t                 r8, r9, r10, r11, r12, r13, r14, r15;   // offset 0x80
     std::array<uint8_t, 512> fxsave_area;                            // offset 0xc0
 } __attribute__((packed));
 
+// fxsave_area is only valid after the thread touched the fpu
+inline auto get_saved_context_size(const ThreadContext& context) -> size_t {
+    return context.fpu_used != 0 ? sizeof(ThreadContext) : offsetof(ThreadContext, fxsave_area);
+}
+
 using ThreadEntry = void(uint64_t data, int64_t id);
 
+enum class SchedulingPolicy : uint8_t {
+    Fixed, // strict priority by nice, round robin on every tick
+    Fair,  // weighted by nice, lowest virtual runtime first
+};
+
 using Nice      = int32_t;
-using EventID   = uint32_t;
+using EventID   = uint64_t; // generation << 32 | slot
 using ProcessID = uint32_t;
 using ThreadID  = uint32_t;
 
 constexpr auto invalid_event = EventID(-1);
 
+// one bit per processor number
+using AffinityMask = uint64_t;
+
+constexpr auto max_processors = sizeof(AffinityMask) * 8;
+static_assert(max_processors <= smp::max_processors);
+constexpr auto any_processor  = AffinityMask(-1);
+
+constexpr auto processor_to_affinity(const smp::ProcessorNumber processor) -> AffinityMask {
+    return processor < max_processors ? AffinityMask(1) << processor : 0;
+}
+
 template <class K, class T>
 using IDMap = dense_map::DenseMap<K, std::unique_ptr<T>>;
 
-using AutoLock = mutex_like::AutoMutex<spinlock::SpinLock>;
-
 struct Thread;
 
+// orders runnable fair threads, lowest virtual runtime first
+struct FairOrder {
+    auto operator()(const Thread* a, const Thread* b) const -> bool;
+};
+
+using FairQueue = std::set<Thread*, FairOrder>;
+
+// (deadline tick, thread) of Manager::wait_interrupt
+using TimeoutQueue = std::set<std::pair<uint64_t, Thread*>>;
+
+// fixed threads run before fair ones, lower nice runs first within a class
+struct Priority {
+    SchedulingPolicy policy = SchedulingPolicy::Fair;
+    Nice             nice   = std::numeric_limits<Nice>::max();
+
+    auto is_higher_than(const Priority& o) const -> bool {
+        if(policy != o.policy) {
+            return policy == SchedulingPolicy::Fixed;
+        }
+        return nice < o.nice;
+    }
+};
+
+// priority lent to a thread by the threads waiting for it
+struct PriorityBoost {
+    Priority       priority;
+    Thread*        target = nullptr;
+    PriorityBoost* next   = nullptr;
+};
+
+// links a waiting thread into an event's waiter list
+struct EventWaiter {
+    Thread*      thread;
+    EventID      event = invalid_event;
+    EventWaiter* prev  = nullptr;
+    EventWaiter* next  = nullptr;
+};
+
+constexpr auto max_waiting_events = size_t(4);
+
 struct ProcessDetail;
 
 struct Process {
@@ -50,31 +110,69 @@ struct Process {
 };
 
 struct Thread {
-    using StackUnitType = uint64_t;
-
     const uint64_t id;
     Process* const process;
-    uintptr_t      system_stack_address;
+    uintptr_t      system_stack_address = 0;
 
-    ThreadEntry*               entry = nullptr;
-    std::vector<StackUnitType> stack;
-    ThreadContext              context;
+    ThreadEntry*  entry     = nullptr;
+    uintptr_t     stack_top = 0;
+    ThreadContext context;
 
-    smp::ProcessorNumber running_on = smp::invalid_processor_number;
-    std::vector<EventID> events;
-    Nice                 nice         = 0;
+    smp::ProcessorNumber running_on   = smp::invalid_processor_number;
+    Nice                 nice         = 0; // base_nice with boosts applied
+    Nice                 base_nice    = 0;
+    PriorityBoost*       boosts       = nullptr;
+    PriorityBoost*       blocked_on   = nullptr; // boost of the mutex this thread sleeps for, to pass boosts down the chain
     size_t               suspend_from = 0;
     size_t               suspend_for  = 0;
     bool                 zombie       = false;
-    bool                 movable      = true;
+    AffinityMask         affinity     = any_processor;
+
+    std::array<EventWaiter, max_waiting_events> waiters;
+
+    std::atomic_bool interrupt_pending = false; // see Manager::notify_interrupt
+
+    // see Manager::queue_wakeup
+    std::atomic_bool wakeup_queued      = false;
+    Thread*          next_queued_wakeup = nullptr;
+
+    SchedulingPolicy     policy         = SchedulingPolicy::Fair; // base_policy with boosts applied
+    SchedulingPolicy     base_policy    = SchedulingPolicy::Fair;
+    uint64_t             vruntime       = 0; // lag from min_vruntime while not queued
+    size_t               slice_start    = 0;
+    FairQueue::node_type fair_node;                // held while not in a fair queue, so queueing never allocates
+    Thread*              next_suspended = nullptr; // see ProcessorLocal::suspended
+
+    TimeoutQueue::node_type timeout_node; // held while not waiting with a deadline
+
+    // statistics, in tsc cycles
+    uint64_t runtime              = 0;
+    uint64_t accounted_at         = 0;
+    uint64_t woken_at             = 0;
+    uint64_t voluntary_switches   = 0;
+    uint64_t involuntary_switches = 0;
+
+    auto can_run_on(const smp::ProcessorNumber processor) const -> bool {
+        return (affinity & processor_to_affinity(processor)) != 0;
+    }
 
-    auto init_context(ThreadEntry* const func, const int64_t data) -> void {
-        constexpr auto default_stack_bytes = size_t(4096);
-        constexpr auto default_stack_count = default_stack_bytes / sizeof(StackUnitType);
+    auto get_priority() const -> Priority {
+        return {policy, nice};
+    }
 
-        entry = func;
-        stack.resize(default_stack_count);
-        const auto stack_end = reinterpret_cast<uint64_t>(&stack[default_stack_count]);
+    auto get_boosted_priority() const -> Priority {
+        auto result = Priority{base_policy, base_nice};
+        for(auto boost = boosts; boost != nullptr; boost = boost->next) {
+            if(boost->priority.is_higher_than(result)) {
+                result = boost->priority;
+            }
+        }
+        return result;
+    }
+
+    auto init_context(ThreadEntry* const func, const int64_t data, const uintptr_t stack) -> void {
+        entry     = func;
+        stack_top = stack;
 
         memset(&context, 0, sizeof(context));
         context.rip = reinterpret_cast<uint64_t>(func);
@@ -85,12 +183,31 @@ struct Thread {
         context.rflags = 0x202;
         context.cs     = segment::kernel_cs.data;
         context.ss     = segment::kernel_ss.data;
-        context.rsp    = (stack_end & ~0x0Flu) - 8;
+        context.rsp    = (stack_top & ~0x0Flu) - 8;
 
         // mask all exceptions of MXCSR
         *reinterpret_cast<uint32_t*>(&context.fxsave_area[24]) = 0x1f80;
     }
 
-    Thread(const uint64_t id, Process* const process) : id(id), process(process) {}
+    Thread(const uint64_t id, Process* const process) : id(id), process(process) {
+        for(auto& waiter : waiters) {
+            waiter.thread = this;
+        }
+
+        auto queue = FairQueue();
+        queue.insert(this);
+        fair_node = queue.extract(queue.begin());
+
+        auto timeouts = TimeoutQueue();
+        timeouts.emplace(0, this);
+        timeout_node = timeouts.extract(timeouts.begin());
+    }
 };
+
+inline auto FairOrder::operator()(const Thread* const a, const Thread* const b) const -> bool {
+    if(a->vruntime != b->vruntime) {
+        return a->vruntime < b->vruntime;
+    }
+    return std::less<const Thread*>()(a, b);
+}
 } // namespace process
@@ -0,0 +1,83 @@
+#pragma once
+#include "arch/amd64/rflags.hpp"
+#include "constants.hpp"
+#include "mutex.hpp"
+#include "process/manager.hpp"
+
+namespace rcu {
+// read-side critical section, readers must not sleep inside
+// the scheduler never runs while interrupts are disabled,
+// so a processor passing switch_thread has left every section it was in
+using ReadGuard = amd64::InterruptGuard;
+
+// waits until every other processor has passed the scheduler
+// must not be called inside a read-side critical section
+inline auto synchronize() -> void {
+    const auto processor_count = process::manager->get_processor_count();
+    const auto this_processor  = smp::get_processor_number();
+
+    auto snapshot = std::array<uint64_t, process::max_processors>();
+    for(auto i = size_t(0); i < processor_count; i += 1) {
+        snapshot[i] = process::manager->get_quiescent_count(i);
+    }
+    for(auto i = size_t(0); i < processor_count; i += 1) {
+        if(i == this_processor) {
+            continue;
+        }
+        while(process::manager->get_quiescent_count(i) == snapshot[i]) {
+            process::manager->suspend_this_thread_for_ms(1000 / constants::context_switch_frequency);
+        }
+    }
+}
+
+template <class R>
+auto is_success(const R& result) -> bool {
+    if constexpr(std::is_same_v<R, Error>) {
+        return !result;
+    } else {
+        return bool(result);
+    }
+}
+
+// readers see a consistent version without locking
+// writers are serialized, publish a modified copy and free the old version after synchronize()
+template <class T>
+class Protected {
+  private:
+    std::atomic<T*> data;
+    Mutex           writer_mutex;
+
+  public:
+    // the result is valid while the guard is alive
+    auto read(const ReadGuard& /*guard*/) const -> const T& {
+        return *data.load(std::memory_order_acquire);
+    }
+
+    // modify returns Error or Result, the copy is published only on success
+    template <class F>
+    auto update(F modify) -> std::invoke_result_t<F, T&> {
+        const auto lock = SmartMutex(writer_mutex);
+
+        const auto copy   = new T(*data.load());
+        auto       result = modify(*copy);
+        if(!is_success(result)) {
+            delete copy;
+            return result;
+        }
+        const auto old = data.exchange(copy, std::memory_order_acq_rel);
+        synchronize();
+        delete old;
+        return result;
+    }
+
+    Protected(const Protected&) = delete;
+
+    template <class... Args>
+    Protected(Args&&... args) : data(new T(std::forward<Args>(args)...)) {
+    }
+
+    ~Protected() {
+        delete data.load();
+    }
+};
+} // namespace rcu
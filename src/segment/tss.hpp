@@ -19,6 +19,7 @@ struct TSSResource {
     std::unique_ptr<TaskStateSegment> tss;
     memory::SmartSingleFrameID                rsp_stack;
     memory::SmartSingleFrameID                rst_stack;
+    memory::SmartSingleFrameID                df_stack;
 };
 
 inline auto setup_tss(GDT& gdt) -> Result<TSSResource> {
@@ -34,6 +35,12 @@ inline auto setup_tss(GDT& gdt) -> Result<TSSResource> {
     }
     auto& rst_stack = rst_stack_r.as_value();
 
+    auto df_stack_r = memory::allocate_single();
+    if(!df_stack_r) {
+        return df_stack_r.as_error();
+    }
+    auto& df_stack = df_stack_r.as_value();
+
     auto tss = std::unique_ptr<TaskStateSegment>(new(std::nothrow) TaskStateSegment);
     if(!tss) {
         return Error::Code::NoEnoughMemory;
@@ -41,11 +48,12 @@ inline auto setup_tss(GDT& gdt) -> Result<TSSResource> {
 
     tss->rsp0                                    = std::bit_cast<uint64_t>(static_cast<std::byte*>(rsp_stack->get_frame()) + memory::bytes_per_frame);
     tss->ist[interrupt::ist_for_lapic_timer - 1] = std::bit_cast<uint64_t>(static_cast<std::byte*>(rst_stack->get_frame()) + memory::bytes_per_frame);
+    tss->ist[interrupt::ist_for_double_fault - 1] = std::bit_cast<uint64_t>(static_cast<std::byte*>(df_stack->get_frame()) + memory::bytes_per_frame);
 
     const auto tss_addr = reinterpret_cast<uint64_t>(tss.get());
     gdt[TSSLow].set_system_segment(DescriptorType::TSSAvailable, 0, tss_addr & 0xFFFFFFFFu, sizeof(tss) - 1);
     gdt[TSSHigh].data = tss_addr >> 32;
     load_tr(SegmentSelector{.bits = {0, 0, TSSLow}}.data);
-    return TSSResource{std::move(tss), std::move(rsp_stack), std::move(rst_stack)};
+    return TSSResource{std::move(tss), std::move(rsp_stack), std::move(rst_stack), std::move(df_stack)};
 }
 }
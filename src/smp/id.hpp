@@ -1,19 +1,84 @@
 #pragma once
 #include <array>
 
+#include "../asmcode.hpp"
 #include "../lapic/registers.hpp"
+#include "../msr.hpp"
+
+namespace process {
+struct Thread;
+}
 
 namespace smp {
 using ProcessorNumber = size_t;
 
 constexpr auto invalid_processor_number = ProcessorNumber(-1);
+constexpr auto max_processors           = size_t(64);
 
 inline auto first_lapic_id                  = uint8_t(0);
 inline auto last_lapic_id                   = uint8_t(0);
 inline auto default_lapic_id_to_index_table = std::array<ProcessorNumber, 1>{0};
 inline auto lapic_id_to_index_table         = default_lapic_id_to_index_table.data();
 
+// per-processor data pointed by the gs base
+// ring 3 may load gs, so every entry from ring 3 swaps to this base with swapgs and swaps back on return
+// the user gs base is kept in KernelGSBase while in ring 0
+// syscall_entry and switch_context read the stacks directly, keep the offsets in sync with the assembly
+struct PerCPU {
+    PerCPU*          self         = nullptr; // gs:0
+    uintptr_t        system_stack = 0;       // gs:8, system stack of the running user thread
+    uintptr_t        switch_stack = 0;       // gs:16, used by switch_context while releasing the scheduler lock
+    ProcessorNumber  number       = 0;
+    uint8_t          lapic_id     = 0;
+    process::Thread* this_thread  = nullptr;
+};
+
+static_assert(offsetof(PerCPU, self) == 0 && offsetof(PerCPU, system_stack) == 8 && offsetof(PerCPU, switch_stack) == 16);
+
+inline auto per_cpus = std::array<PerCPU, max_processors>();
+
+inline auto get_per_cpu() -> PerCPU& {
+    auto self = (PerCPU*)(nullptr);
+    __asm__ volatile("mov %0, gs:0"
+                     : "=r"(self));
+    return *self;
+}
+
 inline auto get_processor_number() -> ProcessorNumber {
-    return lapic_id_to_index_table[lapic::read_lapic_id()];
+    return get_per_cpu().number;
+}
+
+// loading a segment register resets the gs base, call this after segment::apply_segments
+inline auto initialize_per_cpu(const ProcessorNumber number) -> void {
+    auto& per_cpu    = per_cpus[number];
+    per_cpu.self     = &per_cpu;
+    per_cpu.number   = number;
+    per_cpu.lapic_id = lapic::read_lapic_id();
+    write_msr(MSR::GSBase, std::bit_cast<uint64_t>(&per_cpu));
+    write_msr(MSR::KernelGSBase, 0);
+}
+
+// for interrupt handlers written in c++, swaps to the per-cpu gs base while the handler runs if the interrupt came from ring 3
+// construct it before anything touching the per-cpu data
+class KernelGSGuard {
+  private:
+    bool from_user;
+
+  public:
+    KernelGSGuard(const uint64_t cs) : from_user((cs & 3) != 0) {
+        if(from_user) {
+            __asm__ volatile("swapgs" ::: "memory");
+        }
+    }
+
+    ~KernelGSGuard() {
+        if(from_user) {
+            __asm__ volatile("swapgs" ::: "memory");
+        }
+    }
+};
+
+inline auto initialize_per_cpu_by_lapic_id() -> void {
+    initialize_per_cpu(lapic_id_to_index_table[lapic::read_lapic_id()]);
 }
 } // namespace smp
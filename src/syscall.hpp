@@ -26,7 +26,7 @@ inline auto syscall_exit(const uint64_t arg0, const uint64_t arg1, const uint64_
 inline auto initialize_syscall() -> void {
     write_msr(MSR::EFER, ExtendedFeatureEnableRegister{.bits = {.sce = 1, .lme = 1, .lma = 1}}.data);
     write_msr(MSR::LSTAR, reinterpret_cast<uint64_t>(syscall_entry));
-    write_msr(MSR::FMASK, 0);
+    write_msr(MSR::FMASK, 0x200); // IF, syscall_entry enables interrupts after swapgs
 
     const auto star_syscall = segment::SegmentSelector{.bits = {0, 0, segment::SegmentNumber::KernelCode}};
     const auto star_sysret  = segment::SegmentSelector{.bits = {3, 0, segment::SegmentNumber::UserStack - 1}};
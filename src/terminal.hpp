@@ -1,5 +1,8 @@
 #pragma once
+#include <charconv>
+
 #include "fs/manager.hpp"
+#include "interrupt/irq.hpp"
 #include "process/elf-startup.hpp"
 
 namespace terminal {
@@ -347,6 +350,10 @@ class Shell {
             if(const auto e = fs::manager->unmount(argv[1])) {
                 print("unmount error: %d\n", e.as_int());
             }
+        } else if(argv[0] == "sync") {
+            if(const auto e = fs::manager->sync()) {
+                print("sync error: %d\n", e.as_int());
+            }
         } else if(argv[0] == "ls") {
             auto path = std::string_view("/");
             if(argv.size() == 2) {
@@ -406,6 +413,95 @@ class Shell {
                 offset += read_size;
                 puts({buffer.data(), read});
             }
+        } else if(argv[0] == "sched") {
+            const auto threads = process::manager->get_thread_statistics();
+            auto       total   = uint64_t(0);
+            for(const auto& t : threads) {
+                total += t.runtime;
+            }
+            puts("  PID   TID NICE  CPU  RUNTIME(%)   VOLUNTARY INVOLUNTARY\n");
+            for(const auto& t : threads) {
+                const auto permille = total == 0 ? 0 : t.runtime * 1000 / total;
+                if(t.running_on == smp::invalid_processor_number) {
+                    print("%5u %5u %4d    - %8lu.%lu %11lu %11lu\n", t.pid, t.tid, t.nice, permille / 10, permille % 10, t.voluntary_switches, t.involuntary_switches);
+                } else {
+                    print("%5u %5u %4d %4lu %8lu.%lu %11lu %11lu\n", t.pid, t.tid, t.nice, t.running_on, permille / 10, permille % 10, t.voluntary_switches, t.involuntary_switches);
+                }
+            }
+
+            puts("wakeup latency(cycles < 2^N: count)\n");
+            const auto latencies = process::manager->get_wakeup_latencies();
+            for(auto cpu = size_t(0); cpu < latencies.size(); cpu += 1) {
+                for(auto i = size_t(0); i < latencies[cpu].size(); i += 1) {
+                    const auto& histogram = latencies[cpu][i];
+                    if(std::all_of(histogram.begin(), histogram.end(), [](const uint64_t n) { return n == 0; })) {
+                        continue;
+                    }
+                    print("cpu%lu nice %d:", cpu, process::index_to_nice(i));
+                    for(auto b = size_t(0); b < histogram.size(); b += 1) {
+                        if(histogram[b] != 0) {
+                            print(" %lu:%lu", b, histogram[b]);
+                        }
+                    }
+                    putc('\n');
+                }
+            }
+        } else if(argv[0] == "irq") {
+            if(argv.size() == 1) {
+                const auto irqs = interrupt::irq_manager->get_irqs();
+                puts("IRQ DEVICE    TYPE CPU VECTOR\n");
+                for(auto i = size_t(0); i < irqs.size(); i += 1) {
+                    const auto& irq = irqs[i];
+                    print("%3lu %02x:%02x.%x %5s %3lu   0x%02x\n", i, irq.device->bus, irq.device->device, irq.device->function, irq.type == interrupt::MSIType::MSI ? "msi" : "msi-x", irq.processor, irq.vector);
+                }
+            } else if(argv.size() == 3) {
+                auto index     = size_t();
+                auto processor = smp::ProcessorNumber();
+                if(std::from_chars(argv[1].begin(), argv[1].end(), index).ec != std::errc() || std::from_chars(argv[2].begin(), argv[2].end(), processor).ec != std::errc()) {
+                    puts("usage: irq IRQ CPU\n");
+                    return true;
+                }
+                const auto irq = interrupt::irq_manager->find(index);
+                if(irq == nullptr) {
+                    puts("no such irq\n");
+                    return true;
+                }
+                if(const auto e = interrupt::irq_manager->set_affinity(*irq, processor)) {
+                    print("irq error: %d\n", e.as_int());
+                }
+            } else {
+                puts("usage: irq\n");
+                puts("       irq IRQ CPU\n");
+            }
+        } else if(argv[0] == "lockstat") {
+            if(!constants::enable_lockstat) {
+                puts("lockstat is disabled, set constants::enable_lockstat\n");
+                return true;
+            }
+            constexpr auto max_rows = size_t(20);
+
+            const auto classes = lockstat::registry.get_classes();
+            auto       sorted  = std::vector<const lockstat::Class*>();
+            for(const auto& c : classes) {
+                sorted.push_back(&c);
+            }
+            std::sort(sorted.begin(), sorted.end(), [](const lockstat::Class* a, const lockstat::Class* b) {
+                return a->wait_cycles.load() > b->wait_cycles.load();
+            });
+            puts("    ACQUIRED   CONTENDED     WAIT(cycles) MAX WAIT(cycles)     HOLD(cycles) CLASS\n");
+            for(auto i = size_t(0); i < std::min(sorted.size(), max_rows); i += 1) {
+                const auto& c = *sorted[i];
+                print("%12lu %11lu %16lu %16lu %16lu ", c.acquisitions.load(), c.contentions.load(), c.wait_cycles.load(), c.max_wait_cycles.load(), c.hold_cycles.load());
+                const auto name = c.name.load();
+                if(name == nullptr) {
+                    puts("(unknown)\n");
+                } else if(c.line == 0) {
+                    const auto type = lockstat::trim_type_name(name);
+                    print("Critical<%.*s>\n", int(type.size()), type.data());
+                } else {
+                    print("%s:%u\n", name, c.line);
+                }
+            }
         } else if(argv[0] == "run") {
             if(argv.size() != 2) {
                 puts("usage: run FILE");
@@ -39,6 +39,11 @@ class DenseMap {
         return key < data.size() && static_cast<bool>(data[key]);
     }
 
+    // keys below this may be valid
+    auto get_slot_count() const -> K {
+        return K(data.size());
+    }
+
     auto empty() const -> bool {
         for(const auto& d : data) {
             if(V::is_valid(d)) {
@@ -0,0 +1,145 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <span>
+#include <string_view>
+
+#include "../arch/amd64/tsc.hpp"
+#include "../constants.hpp"
+
+// lock contention statistics, enabled by constants::enable_lockstat
+// locks are grouped into classes by their construction site, or by the protected type for Critical<>
+namespace lockstat {
+struct Class {
+    std::atomic<const char*> name = nullptr;
+    uint32_t                 line = 0;
+
+    std::atomic_uint64_t acquisitions    = 0;
+    std::atomic_uint64_t contentions     = 0;
+    std::atomic_uint64_t wait_cycles     = 0;
+    std::atomic_uint64_t max_wait_cycles = 0;
+    std::atomic_uint64_t hold_cycles     = 0;
+};
+
+constexpr auto max_classes = size_t(256);
+
+class Registry {
+  private:
+    std::array<Class, max_classes> classes;
+    std::atomic_size_t             count = 0;
+    std::atomic_flag               lock; // locks can not be used here
+
+  public:
+    auto find_or_create(const char* const name, const uint32_t line) -> Class* {
+        while(lock.test_and_set(std::memory_order_acquire)) {
+            __asm__("pause");
+        }
+
+        auto       result = (Class*)(nullptr);
+        const auto num    = count.load(std::memory_order_relaxed);
+        for(auto i = size_t(0); i < num; i += 1) {
+            if(classes[i].name.load(std::memory_order_relaxed) == name && classes[i].line == line) {
+                result = &classes[i];
+                break;
+            }
+        }
+        if(result == nullptr && num < classes.size()) {
+            result       = &classes[num];
+            result->line = line;
+            result->name.store(name, std::memory_order_relaxed);
+            count.store(num + 1, std::memory_order_release);
+        }
+
+        lock.clear(std::memory_order_release);
+        return result;
+    }
+
+    auto get_classes() -> std::span<Class> {
+        return {classes.data(), count.load(std::memory_order_acquire)};
+    }
+};
+
+inline auto registry = Registry();
+
+template <class T>
+constexpr auto type_name() -> const char* {
+    return __PRETTY_FUNCTION__;
+}
+
+// strips the function signature from type_name()
+inline auto trim_type_name(const std::string_view name) -> std::string_view {
+    const auto begin = name.find("T = ");
+    if(begin == std::string_view::npos) {
+        return name;
+    }
+    const auto type = name.substr(begin + 4);
+    return type.substr(0, type.find_first_of(";]"));
+}
+
+// locks may be constant initialized, so the class is looked up on the first acquisition
+template <bool enabled = constants::enable_lockstat>
+class Stat {
+  private:
+    const char* name;
+    uint32_t    line;
+    Class*      target      = nullptr;
+    uint64_t    acquired_at = 0;
+
+    auto get_target() -> Class* {
+        if(target == nullptr) {
+            target = registry.find_or_create(name, line);
+        }
+        return target;
+    }
+
+  public:
+    static auto now() -> uint64_t {
+        return amd64::read_tsc();
+    }
+
+    auto on_aquire(const uint64_t wait_begin, const bool contended) -> void {
+        acquired_at       = now();
+        const auto target = get_target();
+        if(target == nullptr) {
+            return;
+        }
+        target->acquisitions.fetch_add(1, std::memory_order_relaxed);
+        if(!contended) {
+            return;
+        }
+        const auto wait = acquired_at - wait_begin;
+        target->contentions.fetch_add(1, std::memory_order_relaxed);
+        target->wait_cycles.fetch_add(wait, std::memory_order_relaxed);
+        auto max = target->max_wait_cycles.load(std::memory_order_relaxed);
+        while(wait > max && !target->max_wait_cycles.compare_exchange_weak(max, wait, std::memory_order_relaxed)) {
+        }
+    }
+
+    auto on_release() -> void {
+        if(target == nullptr) {
+            return;
+        }
+        target->hold_cycles.fetch_add(now() - acquired_at, std::memory_order_relaxed);
+    }
+
+    constexpr Stat(const char* const name, const uint32_t line) : name(name), line(line) {
+    }
+};
+
+template <>
+class Stat<false> {
+  public:
+    static auto now() -> uint64_t {
+        return 0;
+    }
+
+    auto on_aquire(const uint64_t /*wait_begin*/, const bool /*contended*/) -> void {
+    }
+
+    auto on_release() -> void {
+    }
+
+    constexpr Stat(const char* const /*name*/, const uint32_t /*line*/) {
+    }
+};
+} // namespace lockstat
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+
+// node of LRUList, embedded in the item as `lru_entry`
+template <class T>
+struct LRUEntry {
+    T*   prev   = nullptr; // toward the cold end
+    T*   next   = nullptr; // toward the hot end
+    bool linked = false;
+};
+
+// intrusive list of items ordered by last use
+// the list owns no items and has no lock of its own
+template <class T>
+class LRUList {
+  private:
+    T*     cold  = nullptr;
+    T*     hot   = nullptr;
+    size_t count = 0;
+
+    auto link(T& item, T* const prev, T* const next) -> void {
+        item.lru_entry = LRUEntry<T>{.prev = prev, .next = next, .linked = true};
+        (prev != nullptr ? prev->lru_entry.next : cold) = &item;
+        (next != nullptr ? next->lru_entry.prev : hot)  = &item;
+        count += 1;
+    }
+
+  public:
+    auto erase(T& item) -> bool {
+        auto& entry = item.lru_entry;
+        if(!entry.linked) {
+            return false;
+        }
+        (entry.prev != nullptr ? entry.prev->lru_entry.next : cold) = entry.next;
+        (entry.next != nullptr ? entry.next->lru_entry.prev : hot)  = entry.prev;
+        entry = LRUEntry<T>();
+        count -= 1;
+        return true;
+    }
+
+    // moves item to the hot end, linking it if needed
+    auto touch(T& item) -> void {
+        erase(item);
+        link(item, hot, nullptr);
+    }
+
+    // for items which should be the next to go
+    auto push_cold(T& item) -> void {
+        erase(item);
+        link(item, nullptr, cold);
+    }
+
+    auto get_coldest() -> T* {
+        return cold;
+    }
+
+    auto size() const -> size_t {
+        return count;
+    }
+};
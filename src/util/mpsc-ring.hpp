@@ -0,0 +1,80 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <bit>
+#include <span>
+
+// fixed capacity multi-producer single-consumer queue
+// push never allocates nor blocks, so it can be called from interrupt handlers on any processor
+// each slot holds the lap of the position it accepts:
+//   2 * lap     : empty, a producer at this lap may fill it
+//   2 * lap + 1 : filled, the consumer at this lap may take it
+// so a zero initialized ring is empty and globals need no constructor
+template <class T, size_t capacity>
+class MPSCRing {
+  private:
+    static_assert(std::has_single_bit(capacity));
+
+    struct Slot {
+        std::atomic_uint64_t state = 0;
+        T                    data;
+    };
+
+    std::array<Slot, capacity> slots;
+    std::atomic_uint64_t       head      = 0; // next position to push
+    std::atomic_uint64_t       tail      = 0; // next position to pop, written by the consumer only
+    std::atomic_uint64_t       overflows = 0;
+
+    static auto to_lap(const uint64_t position) -> uint64_t {
+        return position / capacity;
+    }
+
+  public:
+    // returns false and counts an overflow if the ring is full
+    auto push(T item) -> bool {
+        auto position = head.load(std::memory_order_relaxed);
+        while(true) {
+            auto&      slot = slots[position % capacity];
+            const auto diff = int64_t(slot.state.load(std::memory_order_acquire) - to_lap(position) * 2);
+            if(diff == 0) {
+                if(head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.data = std::move(item);
+                    slot.state.store(to_lap(position) * 2 + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0) {
+                // the consumer has not taken the previous lap yet
+                overflows.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // moves up to buffer.size() items into buffer, consumer only
+    auto pop(const std::span<T> buffer) -> size_t {
+        auto position = tail.load(std::memory_order_relaxed);
+        auto count    = size_t(0);
+        for(; count < buffer.size(); count += 1, position += 1) {
+            auto& slot = slots[position % capacity];
+            if(slot.state.load(std::memory_order_acquire) != to_lap(position) * 2 + 1) {
+                break;
+            }
+            buffer[count] = std::move(slot.data);
+            slot.state.store((to_lap(position) + 1) * 2, std::memory_order_release);
+        }
+        tail.store(position, std::memory_order_relaxed);
+        return count;
+    }
+
+    auto empty() const -> bool {
+        const auto position = tail.load(std::memory_order_relaxed);
+        return slots[position % capacity].state.load(std::memory_order_acquire) != to_lap(position) * 2 + 1;
+    }
+
+    // returns the number of dropped items since the last call
+    auto take_overflows() -> uint64_t {
+        return overflows.exchange(0, std::memory_order_relaxed);
+    }
+};
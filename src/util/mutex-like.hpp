@@ -1,6 +1,8 @@
 #pragma once
 #include <optional>
 
+#include "lockstat.hpp"
+
 namespace mutex_like {
 template <class T>
 concept MutexLike = requires(T& mutex) {
@@ -12,6 +14,10 @@ concept MutexLike = requires(T& mutex) {
 using LockedMutex           = bool;
 constexpr auto locked_mutex = LockedMutex(true);
 
+// passes an option to the mutex of SharedValue, e.g. direct handoff of Mutex
+struct MutexOption {};
+constexpr auto mutex_option = MutexOption();
+
 template <MutexLike Mutex>
 class AutoMutex {
   private:
@@ -48,10 +54,42 @@ class AutoMutex {
     }
 };
 
+template <class T>
+concept SharedMutexLike = MutexLike<T> && requires(T& mutex) {
+                                              mutex.aquire_shared();
+                                              mutex.release_shared();
+                                          };
+
+template <SharedMutexLike Mutex>
+class AutoSharedMutex {
+  private:
+    Mutex* mutex = nullptr;
+
+  public:
+    auto release() -> void {
+        if(mutex != nullptr) {
+            std::exchange(mutex, nullptr)->release_shared();
+        }
+    }
+
+    AutoSharedMutex(AutoSharedMutex&& o) {
+        release();
+        mutex = std::exchange(o.mutex, nullptr);
+    }
+
+    AutoSharedMutex(Mutex& mutex) : mutex(&mutex) {
+        mutex.aquire_shared();
+    }
+
+    ~AutoSharedMutex() {
+        release();
+    }
+};
+
 template <MutexLike Mutex, class T>
 class SharedValue {
   private:
-    mutable Mutex mutex;
+    mutable Mutex mutex = Mutex(lockstat::type_name<T>(), 0); // lock class is keyed by the protected type
     T             data;
 
   public:
@@ -88,5 +126,42 @@ class SharedValue {
     template <class... Args>
     SharedValue(Args&&... args) : data(std::forward<Args>(args)...) {
     }
+
+    template <class Option, class... Args>
+    SharedValue(MutexOption, Option&& option, Args&&... args) : mutex(std::forward<Option>(option), lockstat::type_name<T>(), 0),
+                                                                 data(std::forward<Args>(args)...) {
+    }
+};
+
+// many readers or one writer
+template <SharedMutexLike Mutex, class T>
+class ReadWriteValue {
+  private:
+    mutable Mutex mutex;
+    T             data;
+
+  public:
+    auto read_access() const -> std::pair<AutoSharedMutex<Mutex>, const T&> {
+        return {AutoSharedMutex(mutex), data};
+    }
+
+    auto write_access() -> std::pair<AutoMutex<Mutex>, T&> {
+        return {AutoMutex(mutex), data};
+    }
+
+    auto unsafe_access() -> T& {
+        return data;
+    }
+
+    ReadWriteValue() {
+    }
+
+    ReadWriteValue(ReadWriteValue&& other) : mutex(std::move(other.mutex)),
+                                             data(std::move(other.data)) {
+    }
+
+    template <class... Args>
+    ReadWriteValue(Args&&... args) : data(std::forward<Args>(args)...) {
+    }
 };
 } // namespace mutex_like
@@ -1,30 +1,89 @@
 #pragma once
+#include "lockstat.hpp"
 #include "mutex-like.hpp"
 
 namespace spinlock {
+// test-and-test-and-set, spins on a plain load so that waiters do not bounce the cache line
 class SpinLock {
   private:
-    std::atomic_uint8_t flag;
+    std::atomic_uint8_t                  flag = 0;
+    [[no_unique_address]] lockstat::Stat<> stat;
+
+    auto try_lock() -> bool {
+        return flag.load(std::memory_order_relaxed) == 0 && flag.exchange(1, std::memory_order_acquire) == 0;
+    }
 
   public:
     auto aquire() -> void {
-        auto expected = uint8_t(0);
-        while(!flag.compare_exchange_weak(expected, 1)) {
-            __asm__("pause");
+        const auto wait_begin = stat.now();
+        const auto contended  = !try_lock();
+        if(contended) {
+            do {
+                while(flag.load(std::memory_order_relaxed) != 0) {
+                    __asm__("pause");
+                }
+            } while(!try_lock());
         }
+        stat.on_aquire(wait_begin, contended);
     }
 
     auto try_aquire() -> bool {
-        auto expected = uint8_t(0);
-        return flag.compare_exchange_weak(expected, 1);
+        if(!try_lock()) {
+            return false;
+        }
+        stat.on_aquire(0, false);
+        return true;
     }
 
     auto release() -> void {
-        flag.store(0);
+        stat.on_release();
+        flag.store(0, std::memory_order_release);
     }
 
     auto get_native() -> std::atomic_uint8_t* {
         return &flag;
     }
+
+    constexpr SpinLock(const char* const file = __builtin_FILE(), const uint32_t line = __builtin_LINE()) : stat(file, line) {
+    }
+};
+
+// fifo spinlock, waiters are served in the order they arrived
+class TicketLock {
+  private:
+    std::atomic_uint16_t                 next  = 0;
+    std::atomic_uint16_t                 owner = 0;
+    [[no_unique_address]] lockstat::Stat<> stat;
+
+  public:
+    auto aquire() -> void {
+        const auto wait_begin = stat.now();
+        const auto ticket     = next.fetch_add(1, std::memory_order_relaxed);
+        const auto contended  = owner.load(std::memory_order_acquire) != ticket;
+        while(owner.load(std::memory_order_acquire) != ticket) {
+            __asm__("pause");
+        }
+        stat.on_aquire(wait_begin, contended);
+    }
+
+    auto try_aquire() -> bool {
+        auto ticket = owner.load(std::memory_order_relaxed);
+        if(next.load(std::memory_order_relaxed) != ticket) {
+            return false;
+        }
+        if(!next.compare_exchange_strong(ticket, uint16_t(ticket + 1), std::memory_order_acquire, std::memory_order_relaxed)) {
+            return false;
+        }
+        stat.on_aquire(0, false);
+        return true;
+    }
+
+    auto release() -> void {
+        stat.on_release();
+        owner.store(owner.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    constexpr TicketLock(const char* const file = __builtin_FILE(), const uint32_t line = __builtin_LINE()) : stat(file, line) {
+    }
 };
 } // namespace spinlock
@@ -2,6 +2,7 @@
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 
 #ifdef CUTIL_NS
 namespace CUTIL_NS {
@@ -38,6 +39,8 @@ struct StringHash {
 template <class T>
 using StringMap = std::unordered_map<std::string, T, internal::StringHash, internal::StringCompare>;
 
+using StringSet = std::unordered_set<std::string, internal::StringHash, internal::StringCompare>;
+
 #ifdef CUTIL_NS
 }
 #endif
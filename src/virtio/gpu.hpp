@@ -2,7 +2,7 @@
 #include <algorithm>
 
 #include "../fs/drivers/dev/fb.hpp"
-#include "../interrupt/vector.hpp"
+#include "../interrupt/irq.hpp"
 #include "../lapic/registers.hpp"
 #include "../log.hpp"
 #include "../pci.hpp"
@@ -398,7 +398,8 @@ class GPUDevice {
     }
 };
 
-inline auto initialize(const ::pci::Device& device) -> Result<std::unique_ptr<GPUDevice>> {
+// control_irq and cursor_irq are routed to the msix entries of each queue
+inline auto initialize(const ::pci::Device& device, interrupt::IRQ& control_irq, interrupt::IRQ& cursor_irq) -> Result<std::unique_ptr<GPUDevice>> {
     queue::Queue::buffer_size_check<internal::buffer_size_max>();
 
     auto cap_addr              = device.read_register(0x34) & 0xFFu;
@@ -454,14 +455,13 @@ inline auto initialize(const ::pci::Device& device) -> Result<std::unique_ptr<GP
         logger(LogLevel::Error, "virtio: gpu: device not ready\n");
         return Error::Code::VirtIODeviceNotReady;
     }
-    const auto lapic_id = lapic::read_lapic_id();
-
     const auto [control_queue_number, cursor_queue_number] = common_config->get_queue_number<2>();
 
     common_config->queue_select = control_queue_number;
 
     auto control_queue = queue::Queue(control_queue_number, common_config, notify_base + common_config->queue_notify_off * notify_off_multiplier);
-    if(const auto error = device.configure_msix_fixed_destination(lapic_id, ::pci::MSITriggerMode::Level, ::pci::MSIDeliveryMode::Fixed, ::interrupt::Vector::VirtIOGPUControl, 0)) {
+    control_irq = interrupt::IRQ{.device = &device, .type = interrupt::MSIType::MSIX, .entry = 0};
+    if(const auto error = interrupt::irq_manager->add(control_irq)) {
         return error;
     }
     queue::set_queue_to_config(*common_config, control_queue_number, control_queue, 0);
@@ -469,7 +469,8 @@ inline auto initialize(const ::pci::Device& device) -> Result<std::unique_ptr<GP
     common_config->queue_select = cursor_queue_number;
 
     auto cursor_queue = queue::Queue(cursor_queue_number, common_config, notify_base + common_config->queue_notify_off * notify_off_multiplier);
-    if(const auto error = device.configure_msix_fixed_destination(lapic_id, ::pci::MSITriggerMode::Level, ::pci::MSIDeliveryMode::Fixed, ::interrupt::Vector::VirtIOGPUCursor, 1)) {
+    cursor_irq = interrupt::IRQ{.device = &device, .type = interrupt::MSIType::MSIX, .entry = 1};
+    if(const auto error = interrupt::irq_manager->add(cursor_irq)) {
         return error;
     }
     queue::set_queue_to_config(*common_config, cursor_queue_number, cursor_queue, 1);
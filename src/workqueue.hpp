@@ -0,0 +1,202 @@
+#pragma once
+#include <deque>
+
+#include "process/manager.hpp"
+#include "util/spinlock.hpp"
+
+// deferred work executed by kernel worker threads
+// each processor has its own bounded pool of workers pinned to it
+// must be called from threads, interrupt handlers should wake their ThreadedHandler instead
+namespace workqueue {
+using Func = void(void* ctx);
+
+struct Work {
+    Func* func;
+    void* ctx;
+};
+
+struct DelayedWork {
+    uint64_t due; // tick
+    Work     work;
+
+    auto operator>(const DelayedWork& o) const -> bool {
+        return due > o.due;
+    }
+};
+
+class WorkQueue {
+  private:
+    // works taken by a worker per lock acquisition
+    constexpr static auto batch_size = size_t(8);
+
+    struct Pool {
+        spinlock::SpinLock            mutex;
+        smp::ProcessorNumber          processor;
+        process::Nice                 nice;
+        size_t                        max_workers;
+        std::deque<Work>              works;
+        std::vector<DelayedWork>      delayed; // min heap by due
+        size_t                        workers = 0;
+        std::vector<process::Thread*> idle_workers;
+    };
+
+    std::array<Pool, smp::max_processors> pools;
+
+    static auto move_due_works(Pool& pool, const uint64_t now) -> void {
+        while(!pool.delayed.empty() && pool.delayed.front().due <= now) {
+            std::pop_heap(pool.delayed.begin(), pool.delayed.end(), std::greater<DelayedWork>());
+            pool.works.push_back(pool.delayed.back().work);
+            pool.delayed.pop_back();
+        }
+    }
+
+    static auto worker_main(const uint64_t /*id*/, const int64_t data) -> void {
+        auto& pool        = *std::bit_cast<Pool*>(data);
+        auto  this_thread = process::manager->get_this_thread();
+        auto  batch       = std::array<Work, batch_size>();
+        while(true) {
+            auto count    = size_t(0);
+            auto deadline = process::Manager::no_deadline;
+            {
+                const auto lock = mutex_like::AutoMutex(pool.mutex);
+                std::erase(pool.idle_workers, this_thread);
+                move_due_works(pool, process::manager->get_tick());
+                for(; count < batch.size() && !pool.works.empty(); count += 1) {
+                    batch[count] = pool.works.front();
+                    pool.works.pop_front();
+                }
+                if(count == 0) {
+                    pool.idle_workers.push_back(this_thread);
+                    if(!pool.delayed.empty()) {
+                        deadline = pool.delayed.front().due;
+                    }
+                }
+            }
+            if(count == 0) {
+                process::manager->wait_interrupt(deadline);
+                continue;
+            }
+            for(auto i = size_t(0); i < count; i += 1) {
+                batch[i].func(batch[i].ctx);
+            }
+        }
+    }
+
+    // returns a worker to notify, or spawns one if the pool is not full yet
+    auto find_worker(const mutex_like::AutoMutex<spinlock::SpinLock>& /*lock*/, Pool& pool, bool& spawn) -> process::Thread* {
+        if(!pool.idle_workers.empty()) {
+            const auto thread = pool.idle_workers.back();
+            pool.idle_workers.pop_back();
+            return thread;
+        }
+        // busy workers pick the work up after their current batch
+        if(pool.workers < pool.max_workers) {
+            pool.workers += 1;
+            spawn = true;
+        }
+        return nullptr;
+    }
+
+    // on failure the work pushed by the caller stays queued only if a worker is left to run it
+    // workers still being spawned count too, the last of them to fail looks after what the others left behind
+    template <class F>
+    auto spawn_worker(Pool& pool, F cancel) -> Error {
+        auto error   = Error();
+        auto retried = false;
+        while(true) {
+            const auto r = process::manager->create_interrupt_thread(worker_main, std::bit_cast<int64_t>(&pool), pool.nice, process::processor_to_affinity(pool.processor), process::SchedulingPolicy::Fair);
+            if(r) {
+                return error;
+            }
+
+            const auto lock = mutex_like::AutoMutex(pool.mutex);
+            pool.workers -= 1;
+            if(pool.workers != 0) {
+                return error;
+            }
+            if(!error) {
+                // with no worker left nobody can have taken the work
+                cancel(pool);
+                error = r.as_error();
+            }
+            if(pool.works.empty() && pool.delayed.empty()) {
+                return error;
+            }
+            if(retried) {
+                logger(LogLevel::Error, "workqueue: %lu works on processor %lu wait for the next queue: %d\n", pool.works.size() + pool.delayed.size(), pool.processor, r.as_error().as_int());
+                return error;
+            }
+            // the rest was queued by callers which were told it succeeded, one more worker is tried for them
+            retried = true;
+            pool.workers += 1;
+        }
+    }
+
+    template <class F, class C>
+    auto queue(const smp::ProcessorNumber processor, F push, C cancel) -> Error {
+        if(processor >= process::manager->get_processor_count()) {
+            return Error::Code::InvalidAffinity;
+        }
+        auto& pool   = pools[processor];
+        auto  worker = (process::Thread*)(nullptr);
+        auto  spawn  = false;
+        {
+            const auto lock = mutex_like::AutoMutex(pool.mutex);
+            push(pool);
+            worker = find_worker(lock, pool, spawn);
+        }
+        if(worker != nullptr) {
+            process::manager->notify_interrupt(worker);
+        }
+        if(spawn) {
+            return spawn_worker(pool, cancel);
+        }
+        return Success();
+    }
+
+  public:
+    auto queue_work_on(const smp::ProcessorNumber processor, Func* const func, void* const ctx) -> Error {
+        return queue(
+            processor,
+            [func, ctx](Pool& pool) { pool.works.push_back(Work{func, ctx}); },
+            [func, ctx](Pool& pool) { pool.works.erase(std::find_if(pool.works.begin(), pool.works.end(), [&](const Work& w) { return w.func == func && w.ctx == ctx; })); });
+    }
+
+    // an idle worker is woken to recompute its deadline
+    auto queue_delayed_work_on(const smp::ProcessorNumber processor, Func* const func, void* const ctx, const size_t ms) -> Error {
+        const auto due = process::manager->get_tick() + process::Manager::ms_to_tick(ms);
+        return queue(
+            processor,
+            [func, ctx, due](Pool& pool) {
+                pool.delayed.push_back(DelayedWork{due, Work{func, ctx}});
+                std::push_heap(pool.delayed.begin(), pool.delayed.end(), std::greater<DelayedWork>());
+            },
+            [func, ctx, due](Pool& pool) {
+                pool.delayed.erase(std::find_if(pool.delayed.begin(), pool.delayed.end(), [&](const DelayedWork& w) { return w.due == due && w.work.func == func && w.work.ctx == ctx; }));
+                std::make_heap(pool.delayed.begin(), pool.delayed.end(), std::greater<DelayedWork>());
+            });
+    }
+
+    WorkQueue(const WorkQueue&) = delete;
+
+    // workers are created on demand, up to max_workers per processor
+    WorkQueue(const size_t max_workers, const process::Nice nice = 0) {
+        for(auto i = size_t(0); i < pools.size(); i += 1) {
+            pools[i].processor   = i;
+            pools[i].nice        = nice;
+            pools[i].max_workers = max_workers;
+        }
+    }
+};
+
+// queues on the calling processor
+inline auto queue_work(WorkQueue& wq, Func* const func, void* const ctx) -> Error {
+    return wq.queue_work_on(smp::get_processor_number(), func, ctx);
+}
+
+inline auto queue_delayed_work(WorkQueue& wq, Func* const func, void* const ctx, const size_t ms) -> Error {
+    return wq.queue_delayed_work_on(smp::get_processor_number(), func, ctx, ms);
+}
+
+inline auto system_queue = (WorkQueue*)(nullptr);
+} // namespace workqueue